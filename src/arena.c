@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 16
+
+Arena arena;
+
+void initArena(size_t ceiling)
+{
+    arena.regions = NULL;
+    arena.low = NULL;
+    arena.high = NULL;
+    arena.reserved = 0;
+    arena.ceiling = ceiling;
+    arena.last = NULL;
+    arena.open = true;
+}
+
+void closeArena()
+{
+    arena.open = false;
+    arena.last = NULL;
+}
+
+void freeArena()
+{
+    ArenaRegion *region = arena.regions;
+    while (region != NULL)
+    {
+        ArenaRegion *next = region->next;
+        munmap(region, region->end - (char *)region);
+        region = next;
+    }
+    initArena(arena.ceiling);
+    arena.open = false;
+}
+
+bool arenaOwns(void *pointer)
+{
+    char *address = (char *)pointer;
+    if (address < arena.low || address >= arena.high)
+    {
+        return false;
+    }
+    for (ArenaRegion *region = arena.regions; region != NULL; region = region->next)
+    {
+        if (address > (char *)region && address < region->end)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static ArenaRegion *newRegion(size_t size)
+{
+    size_t regionSize = ARENA_REGION_SIZE;
+    size_t needed = sizeof(ArenaRegion) + size + ARENA_ALIGNMENT;
+    if (needed > regionSize)
+    {
+        regionSize = (needed + ARENA_REGION_SIZE - 1) & ~(size_t)(ARENA_REGION_SIZE - 1);
+    }
+    if (arena.reserved + regionSize > arena.ceiling)
+    {
+        return NULL;
+    }
+    void *memory = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return NULL;
+    }
+    ArenaRegion *region = (ArenaRegion *)memory;
+    region->top = (char *)memory + ((sizeof(ArenaRegion) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1));
+    region->end = (char *)memory + regionSize;
+    region->next = arena.regions;
+    arena.regions = region;
+    arena.reserved += regionSize;
+    if (arena.low == NULL || (char *)memory < arena.low)
+    {
+        arena.low = (char *)memory;
+    }
+    if (region->end > arena.high)
+    {
+        arena.high = region->end;
+    }
+    return region;
+}
+
+// returns NULL when the arena can't serve the request, the caller then falls
+// back to malloc
+void *arenaReallocate(void *pointer, size_t oldSize, size_t newSize)
+{
+    if (!arena.open || (pointer != NULL && !arenaOwns(pointer)))
+    {
+        return NULL;
+    }
+    if (newSize <= oldSize)
+    {
+        return pointer;
+    }
+    size_t aligned = (newSize + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    ArenaRegion *region = arena.regions;
+    // the newest buffer is usually the one being grown (arrays, constants)
+    if (pointer != NULL && pointer == arena.last && (char *)pointer + aligned <= region->end)
+    {
+        region->top = (char *)pointer + aligned;
+        return pointer;
+    }
+    if (region == NULL || region->top + aligned > region->end)
+    {
+        region = newRegion(aligned);
+        if (region == NULL)
+        {
+            closeArena();
+            return NULL;
+        }
+    }
+    char *result = region->top;
+    region->top += aligned;
+    arena.last = result;
+    if (pointer != NULL)
+    {
+        memcpy(result, pointer, oldSize);
+    }
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef clox_arena_h
+#define clox_arena_h
+
+#include "common.h"
+
+// Bump allocated regions for the buffers owned by objects in --arena mode.
+// Nothing allocated here is freed on its own: the regions are dropped all
+// at once when the VM shuts down. The arena is closed by the first
+// collection (or when its regions would pass the ceiling), after which new
+// buffers come from malloc again and the usual GC takes over.
+#define ARENA_REGION_SIZE (1024 * 1024)
+
+typedef struct ArenaRegion
+{
+    struct ArenaRegion *next;
+    char *top;
+    char *end;
+} ArenaRegion;
+
+typedef struct
+{
+    ArenaRegion *regions; // current region first
+    char *low;            // bounds of all regions, for a quick ownership test
+    char *high;
+    size_t reserved;
+    size_t ceiling;
+    char *last; // most recent allocation, the only one that can grow in place
+    bool open;
+} Arena;
+
+extern Arena arena;
+
+void initArena(size_t ceiling);
+void closeArena();
+void freeArena();
+bool arenaOwns(void *pointer);
+void *arenaReallocate(void *pointer, size_t oldSize, size_t newSize);
+
+#endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "memory.h"
 #include "debug.h"
 #include "vm.h"
+#include "gcstats.h"
 
 void initChunk(Chunk *chunk)
 {
@@ -13,8 +14,15 @@ void initChunk(Chunk *chunk)
     initValueArray(&chunk->constants);
 }
 
+// chunks only belong to functions, so their arrays are counted under them
+static size_t chunkBytes(Chunk *chunk)
+{
+    return (sizeof(uint8_t) + sizeof(int)) * chunk->capacity + sizeof(Value) * chunk->constants.capacity;
+}
+
 void freeChunk(Chunk *chunk)
 {
+    gcStatsResize(OBJ_FUNCTION, chunkBytes(chunk), 0);
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
     freeValueArray(&chunk->constants);
@@ -25,10 +33,12 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line)
 {
     if (chunk->capacity < chunk->count + 1)
     {
+        size_t oldBytes = chunkBytes(chunk);
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
         chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+        gcStatsResize(OBJ_FUNCTION, oldBytes, chunkBytes(chunk));
     }
     chunk->code[chunk->count] = byte;
     chunk->lines[chunk->count] = line;
@@ -38,7 +48,9 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line)
 int addConstant(Chunk *chunk, Value value)
 {
     push(value); // keep on stack to avoid GC
+    size_t oldBytes = chunkBytes(chunk);
     writeValueArray(&chunk->constants, value);
+    gcStatsResize(OBJ_FUNCTION, oldBytes, chunkBytes(chunk));
     pop();
     return chunk->constants.count - 1;
 }
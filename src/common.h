@@ -7,9 +7,18 @@
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void)(address))
+#endif
+
 // #define DEBUG_PRINT_CODE
 // #define DEBUG_TRACE_EXECUTION
 // #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
 
+// store references between objects as 32 bit heap offsets, see heap.h
+// #define COMPRESSED_REFS
+
 #endif
\ No newline at end of file
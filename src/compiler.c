@@ -7,6 +7,7 @@
 #include "value.h"
 #include "object.h"
 #include "memory.h"
+#include "number.h"
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
@@ -256,7 +257,7 @@ static void initCompiler(Compiler *compiler, FunctionType type)
     current = compiler;
     if (type != TYPE_SCRIPT)
     {
-        current->function->name = copyString((char *)parser.previous.start, parser.previous.length);
+        current->function->name = TO_REF(copyString((char *)parser.previous.start, parser.previous.length));
     }
     // reserve slot 0 for 'this' on methods and initializers
     Local *local = &current->locals[current->localCount++];
@@ -281,7 +282,8 @@ static ObjFunction *endCompiler()
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError)
     {
-        disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
+        ObjString *name = DEREF(ObjString, function->name);
+        disassembleChunk(currentChunk(), name != NULL ? name->chars : "<script>");
     }
 #endif
     current = current->enclosing;
@@ -488,7 +490,7 @@ static void variable(bool canAssign)
 
 static void number(bool canAssign)
 {
-    double value = strtod(parser.previous.start, NULL);
+    double value = parseNumber(parser.previous.start, parser.previous.length);
     emitConstant(NUMBER_VAL(value));
 }
 
@@ -1006,6 +1008,10 @@ static void method()
 {
     consume(TOKEN_IDENTIFIER, "Expect method name.");
     uint8_t nameConstant = identifierConstant(&parser.previous);
+    if (!assignSelector(AS_STRING(currentChunk()->constants.values[nameConstant])))
+    {
+        error("Too many method names.");
+    }
     if (parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4) == 0)
     {
         function(TYPE_INITIALIZER);
@@ -1100,10 +1106,23 @@ ObjFunction *compile(const char *source)
     return parser.hadError ? NULL : function;
 }
 
+bool isCompiling()
+{
+    return current != NULL;
+}
+
 void markCompilerRoots()
 {
     for (Compiler *compiler = current; compiler != NULL; compiler = compiler->enclosing)
     {
         markObject((Obj *)compiler->function);
     }
+}
+
+void forwardCompilerRoots()
+{
+    for (Compiler *compiler = current; compiler != NULL; compiler = compiler->enclosing)
+    {
+        compiler->function = (ObjFunction *)forwardObject((Obj *)compiler->function);
+    }
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define clox_compiler_h
 
 ObjFunction *compile(const char *source);
+bool isCompiling();
 void markCompilerRoots();
+void forwardCompilerRoots();
 
 #endif
\ No newline at end of file
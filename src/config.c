@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+
+Config config;
+static bool minHeapGiven; // otherwise the default gives way to a smaller --gc-max-heap
+
+void initConfig()
+{
+    config.gcStats = GC_STATS_OFF;
+    config.gcMode = GC_MODE_TRACE;
+    config.gcLog = false;
+    config.gcInitialHeap = 1024 * 1024;
+    config.gcMinHeap = 1024 * 1024;
+    config.gcMaxHeap = 0;
+    minHeapGiven = false;
+    config.gcGrowthFactor = 2;
+    config.gcTargetCpu = 5;
+    config.gcMemoryLimit = 0;
+    config.gcCgroupFile = "/sys/fs/cgroup/memory.max";
+    config.gcCompact = false;
+    config.gcFreeThread = false;
+    config.gcLargeThreshold = 64 * 1024;
+    config.gcMarkPrefetch = 6;
+    config.gcIdleBudget = 10;
+    config.gcTrace = NULL;
+    config.gcTracePrecision = 0;
+    config.lazyIntern = false;
+    config.hashSeed = 0;
+    config.arena = false;
+    config.arenaCeiling = 256 * 1024 * 1024;
+    config.gcCompactThreshold = 0.5;
+    config.outputMode = OUTPUT_LINE;
+}
+
+// returns the text after "name=" when the option matches, NULL otherwise
+static const char *optionValue(const char *option, const char *name)
+{
+    size_t length = strlen(name);
+    if (strncmp(option, name, length) == 0 && option[length] == '=')
+    {
+        return option + length + 1;
+    }
+    return NULL;
+}
+
+// sizes accept an optional k, m or g suffix
+static bool parseSize(const char *text, size_t *size)
+{
+    char *end;
+    double value = strtod(text, &end);
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        value *= 1024;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        value *= 1024 * 1024;
+        end++;
+        break;
+    case 'g':
+    case 'G':
+        value *= 1024 * 1024 * 1024;
+        end++;
+        break;
+    }
+    if (end == text || *end != '\0' || value < 0)
+    {
+        return false;
+    }
+    *size = (size_t)value;
+    return true;
+}
+
+static bool parseNumber(const char *text, double *number)
+{
+    char *end;
+    double value = strtod(text, &end);
+    if (end == text || *end != '\0' || value < 0)
+    {
+        return false;
+    }
+    *number = value;
+    return true;
+}
+
+typedef struct
+{
+    const char *variable;
+    const char *option;
+} EnvironmentOption;
+
+static EnvironmentOption environmentOptions[] = {
+    {"LOX_GC_MODE", "--gc-mode"},
+    {"LOX_GC_INITIAL_HEAP", "--gc-initial-heap"},
+    {"LOX_GC_MIN_HEAP", "--gc-min-heap"},
+    {"LOX_GC_MAX_HEAP", "--gc-max-heap"},
+    {"LOX_GC_GROWTH", "--gc-growth"},
+    {"LOX_GC_TARGET_CPU", "--gc-target-cpu"},
+    {"LOX_GC_MEMORY_LIMIT", "--gc-memory-limit"},
+    {"LOX_GC_CGROUP_FILE", "--gc-cgroup-file"},
+    {"LOX_GC_LARGE_THRESHOLD", "--gc-large-threshold"},
+    {"LOX_GC_MARK_PREFETCH", "--gc-mark-prefetch"},
+    {"LOX_GC_IDLE_BUDGET", "--gc-idle-budget"},
+    {"LOX_GC_TRACE", "--gc-trace"},
+    {"LOX_HASH_SEED", "--hash-seed"},
+    {"LOX_OUTPUT", "--output"},
+};
+
+// environment variables are read first so command line options override them
+void loadEnvironment()
+{
+    for (size_t i = 0; i < sizeof(environmentOptions) / sizeof(EnvironmentOption); i++)
+    {
+        const char *value = getenv(environmentOptions[i].variable);
+        if (value == NULL)
+        {
+            continue;
+        }
+        char option[256];
+        snprintf(option, sizeof(option), "%s=%s", environmentOptions[i].option, value);
+        if (!parseOption(option))
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", environmentOptions[i].variable, value);
+        }
+    }
+}
+
+bool parseOption(const char *option)
+{
+    const char *value;
+    if (strcmp(option, "--gc-stats") == 0)
+    {
+        config.gcStats = GC_STATS_TEXT;
+    }
+    else if ((value = optionValue(option, "--gc-stats")) != NULL)
+    {
+        if (strcmp(value, "text") == 0)
+        {
+            config.gcStats = GC_STATS_TEXT;
+        }
+        else if (strcmp(value, "json") == 0)
+        {
+            config.gcStats = GC_STATS_JSON;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if ((value = optionValue(option, "--gc-mode")) != NULL)
+    {
+        if (strcmp(value, "trace") == 0)
+        {
+            config.gcMode = GC_MODE_TRACE;
+        }
+        else if (strcmp(value, "rc") == 0)
+        {
+            config.gcMode = GC_MODE_RC;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if (strcmp(option, "--gc-log") == 0)
+    {
+        config.gcLog = true;
+    }
+    else if ((value = optionValue(option, "--gc-initial-heap")) != NULL)
+    {
+        return parseSize(value, &config.gcInitialHeap);
+    }
+    else if ((value = optionValue(option, "--gc-min-heap")) != NULL)
+    {
+        minHeapGiven = true;
+        return parseSize(value, &config.gcMinHeap);
+    }
+    else if ((value = optionValue(option, "--gc-max-heap")) != NULL)
+    {
+        return parseSize(value, &config.gcMaxHeap);
+    }
+    else if ((value = optionValue(option, "--gc-growth")) != NULL)
+    {
+        return parseNumber(value, &config.gcGrowthFactor) && config.gcGrowthFactor > 1;
+    }
+    else if ((value = optionValue(option, "--gc-target-cpu")) != NULL)
+    {
+        return parseNumber(value, &config.gcTargetCpu);
+    }
+    else if ((value = optionValue(option, "--gc-memory-limit")) != NULL)
+    {
+        return parseSize(value, &config.gcMemoryLimit);
+    }
+    else if ((value = optionValue(option, "--gc-cgroup-file")) != NULL)
+    {
+        config.gcCgroupFile = strdup(value);
+    }
+    else if (strcmp(option, "--gc-compact") == 0)
+    {
+        config.gcCompact = true;
+    }
+    else if ((value = optionValue(option, "--gc-compact-threshold")) != NULL)
+    {
+        config.gcCompact = true;
+        return parseNumber(value, &config.gcCompactThreshold) && config.gcCompactThreshold <= 1;
+    }
+    else if (strcmp(option, "--gc-free-thread") == 0)
+    {
+        config.gcFreeThread = true;
+    }
+    else if ((value = optionValue(option, "--gc-large-threshold")) != NULL)
+    {
+        return parseSize(value, &config.gcLargeThreshold) && config.gcLargeThreshold > 0;
+    }
+    else if ((value = optionValue(option, "--gc-mark-prefetch")) != NULL)
+    {
+        double depth;
+        if (!parseNumber(value, &depth) || depth < 0 || depth > GC_MARK_PREFETCH_MAX)
+        {
+            return false;
+        }
+        config.gcMarkPrefetch = (int)depth;
+    }
+    else if ((value = optionValue(option, "--gc-idle-budget")) != NULL)
+    {
+        return parseNumber(value, &config.gcIdleBudget);
+    }
+    else if ((value = optionValue(option, "--gc-trace")) != NULL)
+    {
+        config.gcTrace = strdup(value);
+    }
+    else if ((value = optionValue(option, "--gc-trace-precision")) != NULL)
+    {
+        return parseSize(value, &config.gcTracePrecision);
+    }
+    else if (strcmp(option, "--lazy-intern") == 0)
+    {
+        config.lazyIntern = true;
+    }
+    else if ((value = optionValue(option, "--hash-seed")) != NULL)
+    {
+        char *end;
+        config.hashSeed = strtoull(value, &end, 0);
+        return end != value && *end == '\0';
+    }
+    else if (strcmp(option, "--arena") == 0)
+    {
+        config.arena = true;
+    }
+    else if ((value = optionValue(option, "--arena-ceiling")) != NULL)
+    {
+        config.arena = true;
+        return parseSize(value, &config.arenaCeiling);
+    }
+    else if ((value = optionValue(option, "--output")) != NULL)
+    {
+        if (strcmp(value, "line") == 0)
+        {
+            config.outputMode = OUTPUT_LINE;
+        }
+        else if (strcmp(value, "full") == 0)
+        {
+            config.outputMode = OUTPUT_FULL;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Options that constrain each other are checked once all of them are
+// parsed. Reports the first conflict and returns false.
+bool checkOptions()
+{
+    if (config.gcMaxHeap > 0 && config.gcMinHeap > config.gcMaxHeap)
+    {
+        if (minHeapGiven)
+        {
+            fprintf(stderr, "Invalid options: --gc-min-heap is above --gc-max-heap\n");
+            return false;
+        }
+        config.gcMinHeap = config.gcMaxHeap; // only the default was in the way
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef clox_config_h
+#define clox_config_h
+
+#include "common.h"
+
+#define GC_MARK_PREFETCH_MAX 32 // size of the marking FIFO, a power of two
+
+typedef enum
+{
+    GC_STATS_OFF,
+    GC_STATS_TEXT,
+    GC_STATS_JSON,
+} GCStatsFormat;
+
+typedef enum
+{
+    GC_MODE_TRACE,
+    GC_MODE_RC, // deferred reference counting, tracing only collects cycles
+} GCMode;
+
+typedef enum
+{
+    OUTPUT_LINE, // flushed after every print
+    OUTPUT_FULL, // flushed when the buffer fills up
+} OutputMode;
+
+typedef struct
+{
+    GCStatsFormat gcStats; // printed to stderr when the VM shuts down
+    GCMode gcMode;
+    bool gcLog;            // one line per collection with the next trigger
+    size_t gcInitialHeap;
+    size_t gcMinHeap;
+    size_t gcMaxHeap; // 0 means unlimited
+    double gcGrowthFactor;
+    double gcTargetCpu; // percent of run time the collector should use
+    size_t gcMemoryLimit; // explicit limit, otherwise read from the cgroup file
+    const char *gcCgroupFile;
+    bool gcCompact;
+    double gcCompactThreshold; // fraction of heap pages that could be released
+    bool gcFreeThread;         // release swept buffers on a background thread
+    size_t gcLargeThreshold;   // buffers this big get their own mapping
+    int gcMarkPrefetch;        // gray objects prefetched ahead of marking, 0 disables
+    double gcIdleBudget;       // milliseconds of collector work between batch scripts
+    const char *gcTrace;       // allocation trace output, see gctrace.h
+    size_t gcTracePrecision;
+    bool lazyIntern;           // runtime strings are interned when their identity is needed
+    uint64_t hashSeed;         // 0 picks a random seed
+    bool arena;                // no collection until arenaCeiling, heap dropped at once on exit
+    size_t arenaCeiling;
+    OutputMode outputMode;
+} Config;
+
+extern Config config;
+
+void initConfig();
+void loadEnvironment();
+bool parseOption(const char *option);
+bool checkOptions();
+
+#endif
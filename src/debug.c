@@ -1,6 +1,7 @@
 #include "stdio.h"
 #include "debug.h"
 #include "object.h"
+#include "vm.h"
 
 int simpleInstruction(const char *name, int offset)
 {
@@ -13,6 +14,7 @@ int constantInstruction(const char *name, Chunk *chunk, int offset)
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s %4d '", name, constant);
     printValue(chunk->constants.values[constant]);
+    flushOutput(&vm.output); // the rest of the line is printed directly
     printf("'\n");
     return offset + 2;
 }
@@ -38,6 +40,7 @@ int invokeInstruction(const char *name, Chunk *chunk, int offset)
     uint8_t argCount = chunk->code[offset + 2];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
     printValue(chunk->constants.values[constant]);
+    flushOutput(&vm.output);
     printf("'\n");
     return offset + 3;
 }
@@ -104,6 +107,7 @@ int disassembleInstruction(Chunk *chunk, int offset)
         uint8_t constant = chunk->code[offset++];
         printf("%-16s %4d ", "OP_CLOSURE", constant);
         printValue(chunk->constants.values[constant]);
+        flushOutput(&vm.output);
         printf("\n");
         ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
         for (int i = 0; i < function->upvalueCount; i++)
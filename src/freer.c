@@ -0,0 +1,140 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freer.h"
+
+#define FREER_BATCH 1024
+
+typedef struct
+{
+    void **pointers;
+    int count;
+    int capacity;
+} FreeList;
+
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    bool running;
+    bool stopping;
+    FreeList pending; // filled by the mutator without locking
+    FreeList queued;  // handed over to the thread
+} Freer;
+
+static Freer freer;
+
+static void appendPointer(FreeList *list, void *pointer)
+{
+    if (list->capacity < list->count + 1)
+    {
+        list->capacity = list->capacity < FREER_BATCH ? FREER_BATCH : list->capacity * 2;
+        list->pointers = (void **)realloc(list->pointers, sizeof(void *) * list->capacity);
+        if (list->pointers == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+    }
+    list->pointers[list->count++] = pointer;
+}
+
+static void *freerMain(void *argument)
+{
+    FreeList batch = {NULL, 0, 0};
+    pthread_mutex_lock(&freer.lock);
+    for (;;)
+    {
+        while (freer.queued.count == 0 && !freer.stopping)
+        {
+            pthread_cond_wait(&freer.ready, &freer.lock);
+        }
+        if (freer.queued.count == 0 && freer.stopping)
+        {
+            break;
+        }
+        // take the whole queue and give back the empty batch
+        FreeList swap = freer.queued;
+        freer.queued = batch;
+        batch = swap;
+        pthread_mutex_unlock(&freer.lock);
+        for (int i = 0; i < batch.count; i++)
+        {
+            free(batch.pointers[i]);
+        }
+        batch.count = 0;
+        pthread_mutex_lock(&freer.lock);
+    }
+    pthread_mutex_unlock(&freer.lock);
+    free(batch.pointers);
+    return NULL;
+}
+
+void initFreer()
+{
+    freer.pending = (FreeList){NULL, 0, 0};
+    freer.queued = (FreeList){NULL, 0, 0};
+    freer.stopping = false;
+    pthread_mutex_init(&freer.lock, NULL);
+    pthread_cond_init(&freer.ready, NULL);
+    freer.running = pthread_create(&freer.thread, NULL, freerMain, NULL) == 0;
+}
+
+void freerDefer(void *pointer)
+{
+    if (!freer.running)
+    {
+        free(pointer);
+        return;
+    }
+    appendPointer(&freer.pending, pointer);
+    if (freer.pending.count >= FREER_BATCH)
+    {
+        freerFlush();
+    }
+}
+
+void freerFlush()
+{
+    if (freer.pending.count == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&freer.lock);
+    if (freer.queued.count == 0)
+    {
+        FreeList swap = freer.queued;
+        freer.queued = freer.pending;
+        freer.pending = swap;
+    }
+    else
+    {
+        for (int i = 0; i < freer.pending.count; i++)
+        {
+            appendPointer(&freer.queued, freer.pending.pointers[i]);
+        }
+        freer.pending.count = 0;
+    }
+    pthread_cond_signal(&freer.ready);
+    pthread_mutex_unlock(&freer.lock);
+}
+
+void stopFreer()
+{
+    if (!freer.running)
+    {
+        return;
+    }
+    freerFlush();
+    pthread_mutex_lock(&freer.lock);
+    freer.stopping = true;
+    pthread_cond_signal(&freer.ready);
+    pthread_mutex_unlock(&freer.lock);
+    pthread_join(freer.thread, NULL);
+    freer.running = false;
+    free(freer.pending.pointers);
+    free(freer.queued.pointers);
+    pthread_mutex_destroy(&freer.lock);
+    pthread_cond_destroy(&freer.ready);
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef clox_freer_h
+#define clox_freer_h
+
+#include "common.h"
+
+// Background thread that releases the buffers owned by swept objects. The
+// sweeper still unlinks the objects and does the byte accounting, only the
+// free() calls are moved off the mutator.
+void initFreer();
+void stopFreer();
+void freerDefer(void *pointer);
+void freerFlush();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "gcstats.h"
+#include "config.h"
+#include "memory.h"
+#include "vm.h"
+#include "pacer.h"
+#include "rc.h"
+
+GCStats gcStats;
+
+static const char *typeNames[GC_TYPE_COUNT] = {
+    [OBJ_STRING] = "string",
+    [OBJ_ROPE] = "rope",
+    [OBJ_VIEW] = "view",
+    [OBJ_NATIVE] = "native",
+    [OBJ_FUNCTION] = "function",
+    [OBJ_CLOSURE] = "closure",
+    [OBJ_UPVALUE] = "upvalue",
+    [OBJ_CLASS] = "class",
+    [OBJ_INSTANCE] = "instance",
+    [OBJ_BOUND_METHOD] = "boundMethod",
+};
+
+void initGCStats()
+{
+    memset(&gcStats, 0, sizeof(gcStats));
+}
+
+double gcClockMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+void gcStatsCollection(double startMs, double markStartMs, double markEndMs, size_t survivors)
+{
+    double pauseMs = gcClockMs() - startMs;
+    gcStats.collections++;
+    gcStats.pauseTotalMs += pauseMs;
+    gcStats.pauseLastMs = pauseMs;
+    if (pauseMs > gcStats.pauseMaxMs)
+    {
+        gcStats.pauseMaxMs = pauseMs;
+    }
+    gcStats.markTotalMs += markEndMs - markStartMs;
+    int bucket = 0;
+    for (double limitUs = 1; bucket < GC_PAUSE_BUCKETS - 1 && pauseMs * 1000 >= limitUs; limitUs *= 2)
+    {
+        bucket++;
+    }
+    gcStats.pauseHistogram[bucket]++;
+    gcStats.survivorsLast = survivors;
+    gcStats.survivorsTotal += survivors;
+    if (config.gcLog)
+    {
+        fprintf(stderr, "[gc %d] pause %.3fms, %zu objects (%zu bytes) survived, heap %zu, "
+                        "gc cpu %.1f%%, growth %.2f, next at %zu\n",
+                gcStats.collections, pauseMs, survivors, vm.bytesMarked, vm.bytesAllocated,
+                pacer.gcCpu * 100, pacer.growth, vm.nextGC);
+    }
+}
+
+static long peakRssKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+static void printText(FILE *out)
+{
+    fprintf(out, "gc collections: %d\n", gcStats.collections);
+    fprintf(out, "gc compactions: %d\n", gcStats.compactions);
+    fprintf(out, "gc pause total: %.3f ms\n", gcStats.pauseTotalMs);
+    fprintf(out, "gc pause max: %.3f ms\n", gcStats.pauseMaxMs);
+    fprintf(out, "gc mark total: %.3f ms\n", gcStats.markTotalMs);
+    fprintf(out, "gc sweep total: %.3f ms\n", gcStats.sweepTotalMs);
+    fprintf(out, "gc compact total: %.3f ms\n", gcStats.compactTotalMs);
+    fprintf(out, "gc idle: %d collections, %.3f ms\n", gcStats.idleCollections, gcStats.idleTotalMs);
+    fprintf(out, "gc pause histogram:\n");
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    {
+        if (gcStats.pauseHistogram[i] > 0)
+        {
+            fprintf(out, "  %s %6lu us: %zu\n", i < GC_PAUSE_BUCKETS - 1 ? "<" : ">=",
+                    1ul << (i < GC_PAUSE_BUCKETS - 1 ? i : i - 1), gcStats.pauseHistogram[i]);
+        }
+    }
+    fprintf(out, "gc survivors last: %zu\n", gcStats.survivorsLast);
+    fprintf(out, "gc survivors total: %zu\n", gcStats.survivorsTotal);
+    fprintf(out, "bytes allocated: %zu\n", gcStats.bytesAllocated);
+    fprintf(out, "bytes freed: %zu\n", gcStats.bytesFreed);
+    fprintf(out, "views detached: %zu\n", gcStats.viewsDetached);
+    fprintf(out, "heap bytes: %zu\n", vm.bytesAllocated);
+    fprintf(out, "heap pages: %d\n", vm.heap.pageCount);
+    fprintf(out, "heap pages released: %d\n", vm.heap.pagesReleased);
+    fprintf(out, "large objects: %zu\n", vm.largeSpace.count);
+    fprintf(out, "large bytes mapped: %zu\n", vm.largeSpace.mappedBytes);
+    fprintf(out, "large remaps: %zu (%zu moved)\n", vm.largeSpace.remaps, vm.largeSpace.remapsMoved);
+    fprintf(out, "rc reconciles: %zu\n", rc.reconciles);
+    fprintf(out, "rc freed: %zu\n", rc.freed);
+    fprintf(out, "peak rss: %ld KB\n", peakRssKb());
+    fprintf(out, "memory limit: %zu\n", pacer.memoryLimit);
+    fprintf(out, "next gc: %zu\n", vm.nextGC);
+    fprintf(out, "%-12s %12s %10s %12s %10s\n", "type", "allocated", "count", "freed", "count");
+    for (int i = 0; i < GC_TYPE_COUNT; i++)
+    {
+        GCTypeStats *type = &gcStats.types[i];
+        fprintf(out, "%-12s %12zu %10zu %12zu %10zu\n", typeNames[i],
+                type->allocatedBytes, type->allocatedCount, type->freedBytes, type->freedCount);
+    }
+}
+
+static void printJson(FILE *out)
+{
+    fprintf(out, "{\"collections\":%d,\"compactions\":%d", gcStats.collections, gcStats.compactions);
+    fprintf(out, ",\"pauseTotalMs\":%.3f,\"pauseMaxMs\":%.3f,\"markTotalMs\":%.3f,\"sweepTotalMs\":%.3f,\"compactTotalMs\":%.3f",
+            gcStats.pauseTotalMs, gcStats.pauseMaxMs, gcStats.markTotalMs, gcStats.sweepTotalMs,
+            gcStats.compactTotalMs);
+    fprintf(out, ",\"idleCollections\":%d,\"idleTotalMs\":%.3f", gcStats.idleCollections, gcStats.idleTotalMs);
+    fprintf(out, ",\"pauseHistogramUs\":[");
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    {
+        fprintf(out, "%s%zu", i > 0 ? "," : "", gcStats.pauseHistogram[i]);
+    }
+    fprintf(out, "],\"survivorsLast\":%zu,\"survivorsTotal\":%zu", gcStats.survivorsLast, gcStats.survivorsTotal);
+    fprintf(out, ",\"bytesAllocated\":%zu,\"bytesFreed\":%zu,\"viewsDetached\":%zu", gcStats.bytesAllocated,
+            gcStats.bytesFreed, gcStats.viewsDetached);
+    fprintf(out, ",\"heapBytes\":%zu,\"heapPages\":%d,\"pagesReleased\":%d,\"memoryLimit\":%zu,\"nextGC\":%zu",
+            vm.bytesAllocated, vm.heap.pageCount, vm.heap.pagesReleased, pacer.memoryLimit, vm.nextGC);
+    fprintf(out, ",\"largeObjects\":%zu,\"largeBytesMapped\":%zu,\"largeRemaps\":%zu,\"largeRemapsMoved\":%zu",
+            vm.largeSpace.count, vm.largeSpace.mappedBytes, vm.largeSpace.remaps, vm.largeSpace.remapsMoved);
+    fprintf(out, ",\"rcReconciles\":%zu,\"rcFreed\":%zu,\"peakRssKb\":%ld", rc.reconciles, rc.freed, peakRssKb());
+    fprintf(out, ",\"types\":{");
+    for (int i = 0; i < GC_TYPE_COUNT; i++)
+    {
+        GCTypeStats *type = &gcStats.types[i];
+        fprintf(out, "%s\"%s\":{\"allocatedBytes\":%zu,\"allocatedCount\":%zu,\"freedBytes\":%zu,\"freedCount\":%zu}",
+                i > 0 ? "," : "", typeNames[i], type->allocatedBytes, type->allocatedCount,
+                type->freedBytes, type->freedCount);
+    }
+    fprintf(out, "}}\n");
+}
+
+void printGCStats(FILE *out, bool json)
+{
+    if (json)
+    {
+        printJson(out);
+    }
+    else
+    {
+        printText(out);
+    }
+}
+
+static void setField(ObjInstance *instance, const char *name, double value)
+{
+    // keep the key on the stack, the table may grow and trigger a GC
+    push(OBJ_VAL(copyString((char *)name, strlen(name))));
+    AS_STRING(peek(0))->obj.flags |= STRING_FIELD_NAME;
+    rcTableSet((Obj *)instance, &instance->fields, AS_STRING(peek(0)), NUMBER_VAL(value));
+    pop();
+}
+
+Value gcStatsNative(int argCount, Value *args)
+{
+    push(OBJ_VAL(copyString("GCStats", 7)));
+    ObjClass *klass = newClass(AS_STRING(peek(0)));
+    push(OBJ_VAL(klass));
+    ObjInstance *instance = newInstance(klass);
+    push(OBJ_VAL(instance));
+    setField(instance, "collections", gcStats.collections);
+    setField(instance, "compactions", gcStats.compactions);
+    setField(instance, "pauseTotalMs", gcStats.pauseTotalMs);
+    setField(instance, "pauseMaxMs", gcStats.pauseMaxMs);
+    setField(instance, "markTotalMs", gcStats.markTotalMs);
+    setField(instance, "sweepTotalMs", gcStats.sweepTotalMs);
+    setField(instance, "compactTotalMs", gcStats.compactTotalMs);
+    setField(instance, "idleCollections", gcStats.idleCollections);
+    setField(instance, "idleTotalMs", gcStats.idleTotalMs);
+    setField(instance, "survivorsLast", gcStats.survivorsLast);
+    setField(instance, "survivorsTotal", gcStats.survivorsTotal);
+    setField(instance, "bytesAllocated", gcStats.bytesAllocated);
+    setField(instance, "bytesFreed", gcStats.bytesFreed);
+    setField(instance, "viewsDetached", gcStats.viewsDetached);
+    setField(instance, "heapBytes", vm.bytesAllocated);
+    setField(instance, "heapPages", vm.heap.pageCount);
+    setField(instance, "pagesReleased", vm.heap.pagesReleased);
+    setField(instance, "largeObjects", vm.largeSpace.count);
+    setField(instance, "largeBytesMapped", vm.largeSpace.mappedBytes);
+    setField(instance, "rcFreed", rc.freed);
+    setField(instance, "memoryLimit", pacer.memoryLimit);
+    setField(instance, "nextGC", vm.nextGC);
+    pop();
+    pop();
+    pop();
+    return OBJ_VAL(instance);
+}
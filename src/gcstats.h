@@ -0,0 +1,76 @@
+#ifndef clox_gcstats_h
+#define clox_gcstats_h
+
+#include <stdio.h>
+#include "common.h"
+#include "object.h"
+
+#define GC_TYPE_COUNT (OBJ_BOUND_METHOD + 1)
+#define GC_PAUSE_BUCKETS 16
+
+typedef struct
+{
+    size_t allocatedBytes;
+    size_t allocatedCount;
+    size_t freedBytes;
+    size_t freedCount;
+} GCTypeStats;
+
+// Counters are always collected, they cost an add per allocation and a
+// couple of clock reads per collection. Reporting is enabled at runtime.
+typedef struct
+{
+    int collections;
+    int compactions;
+    double pauseTotalMs;
+    double pauseMaxMs;
+    double pauseLastMs;
+    double markTotalMs;
+    double sweepTotalMs; // lazy sweeping done by the allocator
+    double compactTotalMs;
+    int idleCollections; // run by gcIdle() instead of the allocation trigger
+    double idleTotalMs;
+    size_t pauseHistogram[GC_PAUSE_BUCKETS]; // bucket i counts pauses under 2^i microseconds
+    size_t survivorsLast;
+    size_t survivorsTotal;
+    size_t bytesAllocated; // every growth through reallocate() and the heap
+    size_t bytesFreed;
+    size_t viewsDetached; // substring views that copied their slice to let the parent go
+    GCTypeStats types[GC_TYPE_COUNT]; // heap slots and the buffers their objects own
+} GCStats;
+
+extern GCStats gcStats;
+
+static inline void gcStatsAllocate(ObjType type, size_t size)
+{
+    gcStats.types[type].allocatedBytes += size;
+    gcStats.types[type].allocatedCount++;
+}
+
+static inline void gcStatsFree(ObjType type, size_t size)
+{
+    gcStats.types[type].freedBytes += size;
+    gcStats.types[type].freedCount++;
+}
+
+// Characters, chunks, vtables and the like are counted under the type of
+// the object owning them, where they are allocated, grown and freed.
+static inline void gcStatsResize(ObjType type, size_t oldSize, size_t newSize)
+{
+    if (newSize > oldSize)
+    {
+        gcStats.types[type].allocatedBytes += newSize - oldSize;
+    }
+    else
+    {
+        gcStats.types[type].freedBytes += oldSize - newSize;
+    }
+}
+
+void initGCStats();
+double gcClockMs();
+void gcStatsCollection(double startMs, double markStartMs, double markEndMs, size_t survivors);
+void printGCStats(FILE *out, bool json);
+Value gcStatsNative(int argCount, Value *args);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include "gctrace.h"
+#include "object.h"
+
+GCTrace gcTrace;
+
+static void writeVarint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        putc((int)(value & 0x7f) | 0x80, gcTrace.file);
+        value >>= 7;
+    }
+    putc((int)value, gcTrace.file);
+}
+
+static inline uint64_t objectId(Obj *object)
+{
+    return (uintptr_t)object >> 4; // slots are granule aligned
+}
+
+static void writeTag(GCTraceTag tag)
+{
+    putc(tag, gcTrace.file);
+    gcTrace.events++;
+}
+
+void startGCTrace(const char *path, size_t precision)
+{
+    gcTrace.file = fopen(path, "wb");
+    gcTrace.precision = precision;
+    gcTrace.events = 0;
+    if (gcTrace.file == NULL)
+    {
+        fprintf(stderr, "Could not open GC trace file \"%s\".\n", path);
+        exit(74);
+    }
+    setvbuf(gcTrace.file, NULL, _IOFBF, 1 << 16);
+    fputs(GC_TRACE_MAGIC, gcTrace.file);
+}
+
+void stopGCTrace()
+{
+    if (!gcTracing())
+    {
+        return;
+    }
+    writeTag(GC_TRACE_END);
+    fclose(gcTrace.file);
+    gcTrace.file = NULL;
+}
+
+void gcTraceAlloc(Obj *object, size_t size)
+{
+    writeTag(GC_TRACE_ALLOC);
+    putc(object->type, gcTrace.file);
+    writeVarint(objectId(object));
+    writeVarint(size);
+}
+
+void gcTraceFree(Obj *object, bool atDeath)
+{
+    writeTag(atDeath ? GC_TRACE_DEATH : GC_TRACE_FREE);
+    writeVarint(objectId(object));
+}
+
+void gcTraceBytes(size_t oldSize, size_t newSize)
+{
+    int64_t delta = (int64_t)newSize - (int64_t)oldSize;
+    if (delta == 0)
+    {
+        return;
+    }
+    writeTag(GC_TRACE_BYTES);
+    writeVarint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+}
+
+void gcTraceStore(Obj *holder, Value value)
+{
+    if (!IS_OBJ(value))
+    {
+        return;
+    }
+    writeTag(GC_TRACE_STORE);
+    writeVarint(objectId(holder));
+    writeVarint(objectId(AS_OBJ(value)));
+}
+
+void gcTraceRoot(Value value)
+{
+    if (!IS_OBJ(value))
+    {
+        return;
+    }
+    writeTag(GC_TRACE_ROOT);
+    writeVarint(objectId(AS_OBJ(value)));
+}
+
+void gcTraceCollection(size_t survivors, size_t bytesMarked, double markMs, double pauseMs)
+{
+    writeTag(GC_TRACE_GC);
+    writeVarint(survivors);
+    writeVarint(bytesMarked);
+    writeVarint((uint64_t)(markMs * 1000));
+    writeVarint((uint64_t)(pauseMs * 1000));
+}
+
+void gcTraceMove(Obj *from, Obj *to)
+{
+    writeTag(GC_TRACE_MOVE);
+    writeVarint(objectId(from));
+    writeVarint(objectId(to));
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef clox_gctrace_h
+#define clox_gctrace_h
+
+#include <stdio.h>
+#include "common.h"
+#include "value.h"
+
+// Allocation trace written with --gc-trace=FILE and replayed by tools/gcsim.
+// The file starts with GC_TRACE_MAGIC, then one record per event: a tag byte
+// followed by unsigned LEB128 varints. Objects are identified by their
+// address in granules; an address is only reused after its FREE record.
+#define GC_TRACE_MAGIC "LOXGCTR1"
+
+typedef enum
+{
+    GC_TRACE_ALLOC = 'A', // type byte, id, slot size
+    GC_TRACE_FREE = 'F',  // id: swept, died before the previous GC record
+    GC_TRACE_DEATH = 'D', // id: freed by reference counting as it died
+    GC_TRACE_BYTES = 'B', // zigzag encoded change of the bytes owned outside of slots
+    GC_TRACE_STORE = 'S', // holder id, stored id: a reference written into an existing object
+    GC_TRACE_ROOT = 'R',  // id: an object stored into a global
+    GC_TRACE_GC = 'G',    // survivors, bytes marked, mark us, pause us
+    GC_TRACE_MOVE = 'M',  // old id, new id: the compactor moved an object
+    GC_TRACE_END = 'E',
+} GCTraceTag;
+
+typedef struct
+{
+    FILE *file;
+    size_t precision; // force a collection after this many bytes, 0 leaves the pacer alone
+    size_t events;
+} GCTrace;
+
+extern GCTrace gcTrace;
+
+static inline bool gcTracing()
+{
+    return gcTrace.file != NULL;
+}
+
+void startGCTrace(const char *path, size_t precision);
+void stopGCTrace();
+void gcTraceAlloc(Obj *object, size_t size);
+void gcTraceFree(Obj *object, bool atDeath);
+void gcTraceBytes(size_t oldSize, size_t newSize);
+void gcTraceStore(Obj *holder, Value value);
+void gcTraceRoot(Value value);
+void gcTraceCollection(size_t survivors, size_t bytesMarked, double markMs, double pauseMs);
+void gcTraceMove(Obj *from, Obj *to);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hash.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HASH_AVX2
+#endif
+
+#define HASH_PRIME32 0x9e3779b1u
+#define HASH_SCRAMBLE_BLOCKS 32 // lanes are scrambled every 1KB
+
+static const uint64_t secret[4] = {
+    0xa0761d6478bd642full,
+    0xe7037ed1a0b428dbull,
+    0x8ebc6af09c88c6e3ull,
+    0x589965cc75374cc3ull,
+};
+
+typedef uint64_t (*BulkFn)(const char *key, size_t blocks, uint64_t seed);
+
+static uint64_t bulkScalar(const char *key, size_t blocks, uint64_t seed);
+
+static uint64_t hashSeed = 0xca01f9dd2a2b4c1bull;
+static BulkFn bulk = bulkScalar;
+
+static inline uint64_t read64(const char *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t read32(const char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// folds the 128 bit product, so every input bit reaches every output bit
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t finishLanes(uint64_t *acc)
+{
+    return mix(acc[0] ^ secret[0], acc[1] ^ secret[1]) ^ mix(acc[2] ^ secret[2], acc[3] ^ secret[3]);
+}
+
+// Each lane adds its input word plus the product of the word's halves after
+// keying it. Adding the word itself keeps its bits when a half is zero. The
+// periodic scramble keeps lanes from saturating on long inputs.
+static uint64_t bulkScalar(const char *key, size_t blocks, uint64_t seed)
+{
+    uint64_t acc[4] = {seed, seed ^ secret[0], seed ^ secret[1], seed ^ secret[2]};
+    for (size_t block = 0; block < blocks; block++, key += 32)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            uint64_t data = read64(key + lane * 8);
+            uint64_t keyed = data ^ secret[lane] ^ seed;
+            acc[lane] += data + (keyed & 0xffffffff) * (keyed >> 32);
+        }
+        if ((block + 1) % HASH_SCRAMBLE_BLOCKS == 0)
+        {
+            for (int lane = 0; lane < 4; lane++)
+            {
+                acc[lane] = ((acc[lane] ^ (acc[lane] >> 47)) ^ secret[lane]) * HASH_PRIME32;
+            }
+        }
+    }
+    return finishLanes(acc);
+}
+
+#ifdef HASH_AVX2
+__attribute__((target("avx2"))) static uint64_t bulkAvx2(const char *key, size_t blocks, uint64_t seed)
+{
+    __m256i secrets = _mm256_set_epi64x((long long)secret[3], (long long)secret[2],
+                                        (long long)secret[1], (long long)secret[0]);
+    __m256i keys = _mm256_xor_si256(secrets, _mm256_set1_epi64x((long long)seed));
+    __m256i acc = _mm256_set_epi64x((long long)(seed ^ secret[2]), (long long)(seed ^ secret[1]),
+                                    (long long)(seed ^ secret[0]), (long long)seed);
+    __m256i prime = _mm256_set1_epi64x(HASH_PRIME32);
+    for (size_t block = 0; block < blocks; block++, key += 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i *)key);
+        __m256i keyed = _mm256_xor_si256(data, keys);
+        __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(data, product));
+        if ((block + 1) % HASH_SCRAMBLE_BLOCKS == 0)
+        {
+            acc = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 47));
+            acc = _mm256_xor_si256(acc, secrets);
+            // 64 by 32 bit multiply from two 32 by 32 bit ones
+            __m256i low = _mm256_mul_epu32(acc, prime);
+            __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(acc, 32), prime);
+            acc = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+        }
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return finishLanes(lanes);
+}
+#endif
+
+void initHash(uint64_t seed)
+{
+    if (seed == 0)
+    {
+        // not meant to be secret, just different from run to run
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        seed = mix((uint64_t)now.tv_nsec ^ secret[0], (uint64_t)now.tv_sec ^ ((uint64_t)getpid() << 32));
+        seed ^= (uint64_t)(uintptr_t)&seed; // address space layout
+    }
+    hashSeed = mix(seed ^ secret[0], secret[1]) | 1;
+#ifdef HASH_AVX2
+    __builtin_cpu_init();
+    bulk = __builtin_cpu_supports("avx2") ? bulkAvx2 : bulkScalar;
+#endif
+}
+
+const char *hashImplementation()
+{
+#ifdef HASH_AVX2
+    if (bulk == bulkAvx2)
+    {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
+
+uint32_t hashString(const char *key, int length)
+{
+    size_t remaining = (size_t)length;
+    uint64_t seed = hashSeed;
+    uint64_t a;
+    uint64_t b;
+    if (remaining <= 16)
+    {
+        if (remaining >= 4)
+        {
+            // two overlapping pairs of reads cover anything from 4 to 16 bytes
+            size_t middle = (remaining >> 3) << 2;
+            a = (read32(key) << 32) | read32(key + middle);
+            b = (read32(key + remaining - 4) << 32) | read32(key + remaining - 4 - middle);
+        }
+        else if (remaining > 0)
+        {
+            a = ((uint64_t)(uint8_t)key[0] << 16) | ((uint64_t)(uint8_t)key[remaining >> 1] << 8) |
+                (uint8_t)key[remaining - 1];
+            b = 0;
+        }
+        else
+        {
+            a = 0;
+            b = 0;
+        }
+    }
+    else
+    {
+        if (remaining >= HASH_BULK_MIN)
+        {
+            size_t blocks = remaining / 32;
+            seed ^= bulk(key, blocks, seed);
+            key += blocks * 32;
+            remaining -= blocks * 32;
+        }
+        while (remaining > 16)
+        {
+            seed = mix(read64(key) ^ secret[1], read64(key + 8) ^ seed);
+            key += 16;
+            remaining -= 16;
+        }
+        // the last 16 bytes, overlapping what was already mixed if needed
+        a = read64(key + remaining - 16);
+        b = read64(key + remaining - 8);
+    }
+    uint64_t hash = mix(a ^ secret[1], b ^ seed);
+    hash = mix(hash ^ secret[0] ^ (uint64_t)length, secret[1] ^ seed);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// FNV-1a, the previous string hash, kept as the benchmark baseline
+uint32_t hashStringFnv(const char *key, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static double benchClockMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static double benchThroughput(uint32_t (*hash)(const char *, int), const char *text, int length, uint32_t *sink)
+{
+    size_t total = (size_t)256 * 1024 * 1024; // bytes hashed per measurement
+    size_t rounds = total / (size_t)length;
+    double startMs = benchClockMs();
+    for (size_t i = 0; i < rounds; i++)
+    {
+        *sink += hash(text, length);
+    }
+    double elapsedMs = benchClockMs() - startMs;
+    return (double)(rounds * (size_t)length) / (1024.0 * 1024.0) / (elapsedMs / 1000.0);
+}
+
+// counts the keys landing on an occupied bucket of a power of two table
+static int benchCollisions(uint32_t (*hash)(const char *, int), int keyCount, int bucketBits)
+{
+    size_t buckets = (size_t)1 << bucketBits;
+    uint8_t *used = calloc(buckets, 1);
+    if (used == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    int collisions = 0;
+    char key[32];
+    for (int i = 0; i < keyCount; i++)
+    {
+        int length = snprintf(key, sizeof(key), "field%d", i);
+        size_t bucket = hash(key, length) & (buckets - 1);
+        collisions += used[bucket];
+        used[bucket] = 1;
+    }
+    free(used);
+    return collisions;
+}
+
+// Compares the hashes on throughput and on how evenly sequential identifiers
+// spread over a table at 75% load.
+void benchHash()
+{
+    static const int lengths[] = {4, 8, 16, 32, 64, 256, 1024, 65536};
+    char *text = malloc(65536);
+    if (text == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    for (int i = 0; i < 65536; i++)
+    {
+        text[i] = (char)('a' + (i * 7) % 26);
+    }
+    uint32_t sink = 0;
+    BulkFn selected = bulk;
+    printf("hash seeded, bulk lanes: %s\n", hashImplementation());
+    printf("%8s %12s %12s %12s\n", "bytes", "fnv MB/s", "scalar MB/s", "selected MB/s");
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        double fnv = benchThroughput(hashStringFnv, text, lengths[i], &sink);
+        bulk = bulkScalar;
+        double scalar = benchThroughput(hashString, text, lengths[i], &sink);
+        bulk = selected;
+        double fast = benchThroughput(hashString, text, lengths[i], &sink);
+        printf("%8d %12.0f %12.0f %12.0f\n", lengths[i], fnv, scalar, fast);
+    }
+    bulk = bulkScalar;
+    uint32_t scalarHash = hashString(text, 65536);
+    bulk = selected;
+    printf("lanes agree: %s\n", scalarHash == hashString(text, 65536) ? "yes" : "no");
+    int keyCount = 3 << 16;
+    printf("collisions for %d keys in %d buckets: fnv %d, hash %d\n", keyCount, 1 << 18,
+           benchCollisions(hashStringFnv, keyCount, 18), benchCollisions(hashString, keyCount, 18));
+    free(text);
+    if (sink == 42)
+    {
+        printf("\n"); // keeps the hashing from being optimized away
+    }
+}
\ No newline at end of file
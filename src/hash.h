@@ -0,0 +1,19 @@
+#ifndef clox_hash_h
+#define clox_hash_h
+
+#include "common.h"
+
+// String hashing for interning and tables. Short strings are mixed a word at
+// a time with 128 bit multiplies (in the spirit of wyhash). Long strings go
+// through four independent 64 bit lanes, 32 bytes per step, which has an AVX2
+// version picked at startup. Both versions give the same hash. The seed is
+// random per process unless --hash-seed pins it.
+#define HASH_BULK_MIN 256 // strings at least this long use the lanes
+
+void initHash(uint64_t seed);
+uint32_t hashString(const char *key, int length);
+uint32_t hashStringFnv(const char *key, int length);
+const char *hashImplementation();
+void benchHash();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,560 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "heap.h"
+#include "memory.h"
+#include "vm.h"
+#include "gcstats.h"
+#include "pacer.h"
+#include "freer.h"
+#include "gctrace.h"
+
+static int sizeClassOf(size_t size)
+{
+    return (int)((size + HEAP_GRANULE - 1) >> HEAP_GRANULE_SHIFT) - 1;
+}
+
+int heapSlotSize(size_t size)
+{
+    return (sizeClassOf(size) + 1) * HEAP_GRANULE;
+}
+
+void initHeap(Heap *heap)
+{
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        heap->classes[i].pages = NULL;
+        heap->classes[i].allocPage = NULL;
+        heap->classes[i].sweepCursor = NULL;
+        heap->classes[i].reusable = NULL;
+    }
+    heap->evacuated = NULL;
+    heap->pageCount = 0;
+    heap->pagesReleased = 0;
+}
+
+#ifdef COMPRESSED_REFS
+char *heapRegion = NULL;
+static size_t regionTop = 0; // pages below this offset were handed out at least once
+static char **regionFree = NULL; // pages given back, mapped without access
+static size_t regionFreeCount = 0;
+static size_t regionFreeCapacity = 0;
+
+static char *mapPage()
+{
+    if (heapRegion == NULL)
+    {
+        // reserve address space only, pages get backed as they are handed out
+        heapRegion = mmap(NULL, HEAP_RESERVE_SIZE, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (heapRegion == MAP_FAILED)
+        {
+            fprintf(stderr, "Could not reserve the compressed heap.\n");
+            exit(1);
+        }
+        regionTop = ((uintptr_t)heapRegion & (HEAP_PAGE_SIZE - 1)) == 0
+                        ? 0
+                        : HEAP_PAGE_SIZE - ((uintptr_t)heapRegion & (HEAP_PAGE_SIZE - 1));
+    }
+    char *page;
+    if (regionFreeCount > 0)
+    {
+        page = regionFree[--regionFreeCount];
+    }
+    else if (regionTop + HEAP_PAGE_SIZE <= HEAP_RESERVE_SIZE)
+    {
+        page = heapRegion + regionTop;
+        regionTop += HEAP_PAGE_SIZE;
+    }
+    else
+    {
+        fprintf(stderr, "Out of memory: the compressed heap is full.\n");
+        exit(1);
+    }
+    if (mprotect(page, HEAP_PAGE_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    return page;
+}
+
+static void unmapPage(char *page)
+{
+    // drop the contents but keep the address range reserved for reuse
+    mmap(page, HEAP_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    if (regionFreeCount == regionFreeCapacity)
+    {
+        regionFreeCapacity = regionFreeCapacity < 64 ? 64 : regionFreeCapacity * 2;
+        regionFree = (char **)realloc(regionFree, regionFreeCapacity * sizeof(char *));
+        if (regionFree == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+    }
+    regionFree[regionFreeCount++] = page;
+}
+#else
+static char *mapPage()
+{
+    // map twice the size and trim both ends to get an aligned page
+    size_t length = HEAP_PAGE_SIZE * 2;
+    char *raw = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    char *aligned = (char *)(((uintptr_t)raw + HEAP_PAGE_SIZE - 1) & ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+    size_t head = aligned - raw;
+    size_t tail = length - head - HEAP_PAGE_SIZE;
+    if (head > 0)
+    {
+        munmap(raw, head);
+    }
+    if (tail > 0)
+    {
+        munmap(aligned + HEAP_PAGE_SIZE, tail);
+    }
+    return aligned;
+}
+
+static void unmapPage(char *page)
+{
+    munmap(page, HEAP_PAGE_SIZE);
+}
+#endif
+
+static HeapPage *newPage(Heap *heap, int sizeClass)
+{
+    HeapPage *page = (HeapPage *)malloc(sizeof(HeapPage));
+    if (page == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    page->base = mapPage();
+    *(HeapPage **)page->base = page;
+    page->sizeClass = sizeClass;
+    page->slotSize = (sizeClass + 1) * HEAP_GRANULE;
+    page->slotCount = (HEAP_PAGE_SIZE - HEAP_PAGE_HEADER) / page->slotSize;
+    page->bumpIndex = 0;
+    page->liveCount = 0;
+    page->swept = true; // nothing to sweep on a fresh page
+    page->evacuating = false;
+    page->released = false;
+    page->reusable = false;
+    page->freeList = NULL;
+    memset(page->markBits, 0, sizeof(page->markBits));
+    memset(page->allocBits, 0, sizeof(page->allocBits));
+    HeapClass *bucket = &heap->classes[sizeClass];
+    page->next = bucket->pages;
+    bucket->pages = page;
+    heap->pageCount++;
+    return page;
+}
+
+static inline Obj *slotAt(HeapPage *page, int index)
+{
+    return (Obj *)(page->base + HEAP_PAGE_HEADER + (size_t)index * page->slotSize);
+}
+
+static Obj *takeSlot(HeapPage *page)
+{
+    Obj *slot = page->freeList;
+    if (slot != NULL)
+    {
+        page->freeList = *(Obj **)slot;
+    }
+    else if (page->bumpIndex < page->slotCount)
+    {
+        slot = slotAt(page, page->bumpIndex++);
+    }
+    else
+    {
+        return NULL;
+    }
+    int granule = heapGranuleOf(page, slot);
+    page->allocBits[granule >> 6] |= (uint64_t)1 << (granule & 63);
+    page->liveCount++;
+    page->released = false;
+    return slot;
+}
+
+static void sweepPage(HeapPage *page)
+{
+    // walk backwards so the rebuilt free list hands out slots in address order
+    page->freeList = NULL;
+    for (int i = page->bumpIndex - 1; i >= 0; i--)
+    {
+        Obj *slot = slotAt(page, i);
+        int granule = heapGranuleOf(page, slot);
+        uint64_t bit = (uint64_t)1 << (granule & 63);
+        if (page->allocBits[granule >> 6] & bit)
+        {
+            if (page->markBits[granule >> 6] & bit)
+            {
+                continue;
+            }
+            page->allocBits[granule >> 6] &= ~bit;
+            page->liveCount--;
+            if (gcTracing())
+            {
+                gcTraceFree(slot, false);
+            }
+            freeObject(slot);
+        }
+        *(Obj **)slot = page->freeList;
+        page->freeList = slot;
+    }
+    memset(page->markBits, 0, sizeof(page->markBits)); // clear marks for the next GC round
+    page->swept = true;
+    freerFlush(); // hand the page's dead buffers to the free thread, if any
+}
+
+// sweeps a page between collections, outside of the collector's pause
+static void sweepLazily(HeapPage *page)
+{
+    size_t before = vm.bytesAllocated;
+    double startMs = gcClockMs();
+    sweepPage(page);
+    double sweepMs = gcClockMs() - startMs;
+    pacer.sweepMs += sweepMs;
+    gcStats.sweepTotalMs += sweepMs;
+    // the trigger was set with this garbage still counted, so move it down with the heap
+    size_t freed = before - vm.bytesAllocated;
+    vm.nextGC = vm.nextGC > freed ? vm.nextGC - freed : 0;
+}
+
+Obj *heapAllocate(Heap *heap, size_t size)
+{
+    int sizeClass = sizeClassOf(size);
+    if (sizeClass >= HEAP_SIZE_CLASSES)
+    {
+        fprintf(stderr, "Object too large for heap: %zu bytes.\n", size);
+        exit(1);
+    }
+    HeapClass *bucket = &heap->classes[sizeClass];
+    for (;;)
+    {
+        if (bucket->allocPage != NULL)
+        {
+            Obj *slot = takeSlot(bucket->allocPage);
+            if (slot != NULL)
+            {
+                return slot;
+            }
+        }
+        // lazy sweeping: reclaim the next page with free slots before mapping a new one
+        HeapPage *page = NULL;
+        while (bucket->sweepCursor != NULL && page == NULL)
+        {
+            HeapPage *candidate = bucket->sweepCursor;
+            bucket->sweepCursor = candidate->next;
+            if (!candidate->swept)
+            {
+                sweepLazily(candidate);
+            }
+            if (candidate->freeList != NULL || candidate->bumpIndex < candidate->slotCount)
+            {
+                page = candidate;
+            }
+        }
+        while (page == NULL && bucket->reusable != NULL)
+        {
+            HeapPage *candidate = bucket->reusable;
+            bucket->reusable = candidate->nextReusable;
+            candidate->reusable = false;
+            if (candidate->freeList != NULL || candidate->bumpIndex < candidate->slotCount)
+            {
+                page = candidate;
+            }
+        }
+        bucket->allocPage = page != NULL ? page : newPage(heap, sizeClass);
+    }
+}
+
+// frees a single object ahead of the sweeper (reference counting found it dead)
+void heapFreeSlot(Heap *heap, Obj *object)
+{
+    HeapPage *page = heapPageOf(object);
+    int granule = heapGranuleOf(page, object);
+    page->allocBits[granule >> 6] &= ~((uint64_t)1 << (granule & 63));
+    page->liveCount--;
+    freeObject(object);
+    if (!page->swept)
+    {
+        return; // the sweeper will find the slot free
+    }
+    *(Obj **)object = page->freeList;
+    page->freeList = object;
+    HeapClass *bucket = &heap->classes[page->sizeClass];
+    if (!page->reusable && page != bucket->allocPage)
+    {
+        page->reusable = true;
+        page->nextReusable = bucket->reusable;
+        bucket->reusable = page;
+    }
+}
+
+void heapFinishSweep(Heap *heap)
+{
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        HeapClass *bucket = &heap->classes[i];
+        for (HeapPage *page = bucket->sweepCursor; page != NULL; page = page->next)
+        {
+            if (!page->swept)
+            {
+                sweepPage(page);
+            }
+        }
+        bucket->sweepCursor = NULL;
+    }
+}
+
+// sweeps ahead of the allocator until the deadline, returns whether every page is swept
+bool heapSweepUntil(Heap *heap, double deadlineMs)
+{
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        for (HeapPage *page = heap->classes[i].sweepCursor; page != NULL; page = page->next)
+        {
+            if (page->swept)
+            {
+                continue;
+            }
+            if (gcClockMs() >= deadlineMs)
+            {
+                return false;
+            }
+            sweepLazily(page);
+        }
+    }
+    return true;
+}
+
+void heapStartSweep(Heap *heap)
+{
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        HeapClass *bucket = &heap->classes[i];
+        for (HeapPage *page = bucket->pages; page != NULL; page = page->next)
+        {
+            page->swept = false;
+            page->reusable = false;
+        }
+        bucket->allocPage = NULL;
+        bucket->reusable = NULL;
+        bucket->sweepCursor = bucket->pages;
+    }
+}
+
+static int countMarked(HeapPage *page)
+{
+    int marked = 0;
+    for (int i = 0; i < HEAP_BITMAP_WORDS; i++)
+    {
+        marked += __builtin_popcountll(page->markBits[i]);
+    }
+    return marked;
+}
+
+// fraction of the pages that would be released if the marked objects were packed
+double heapFragmentation(Heap *heap)
+{
+    if (heap->pageCount == 0)
+    {
+        return 0;
+    }
+    int needed = 0;
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        int marked = 0;
+        int slotCount = 0;
+        for (HeapPage *page = heap->classes[i].pages; page != NULL; page = page->next)
+        {
+            marked += countMarked(page);
+            slotCount = page->slotCount;
+        }
+        if (slotCount > 0)
+        {
+            needed += (marked + slotCount - 1) / slotCount;
+        }
+    }
+    return 1.0 - (double)needed / heap->pageCount;
+}
+
+static int compareLiveCount(const void *a, const void *b)
+{
+    return (*(HeapPage **)b)->liveCount - (*(HeapPage **)a)->liveCount;
+}
+
+// Moves the objects of the sparsest pages of each size class into the free
+// slots of the densest ones, leaving a forwarding pointer in each old slot.
+// Expects a fully swept heap. Returns the number of pages evacuated.
+int heapEvacuate(Heap *heap)
+{
+    int evacuated = 0;
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        HeapClass *bucket = &heap->classes[i];
+        int pageCount = 0;
+        int live = 0;
+        int slotCount = 0;
+        for (HeapPage *page = bucket->pages; page != NULL; page = page->next)
+        {
+            pageCount++;
+            live += page->liveCount;
+            slotCount = page->slotCount;
+        }
+        if (pageCount == 0)
+        {
+            continue;
+        }
+        int needed = (live + slotCount - 1) / slotCount;
+        if (needed >= pageCount)
+        {
+            continue;
+        }
+        HeapPage **pages = (HeapPage **)malloc(sizeof(HeapPage *) * pageCount);
+        if (pages == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+        int count = 0;
+        for (HeapPage *page = bucket->pages; page != NULL; page = page->next)
+        {
+            pages[count++] = page;
+        }
+        qsort(pages, pageCount, sizeof(HeapPage *), compareLiveCount);
+        int target = 0;
+        for (int p = needed; p < pageCount; p++)
+        {
+            HeapPage *page = pages[p];
+            page->evacuating = true;
+            for (int slot = 0; slot < page->bumpIndex; slot++)
+            {
+                Obj *object = slotAt(page, slot);
+                int granule = heapGranuleOf(page, object);
+                if (!((page->allocBits[granule >> 6] >> (granule & 63)) & 1))
+                {
+                    continue;
+                }
+                Obj *copy;
+                while ((copy = takeSlot(pages[target])) == NULL)
+                {
+                    target++;
+                }
+                memcpy(copy, object, page->slotSize);
+                if (gcTracing())
+                {
+                    gcTraceMove(object, copy);
+                }
+                *(Obj **)object = copy;
+            }
+            page->next = heap->evacuated;
+            heap->evacuated = page;
+        }
+        // rebuild the class list with the surviving pages, in density order
+        bucket->pages = NULL;
+        for (int p = needed - 1; p >= 0; p--)
+        {
+            pages[p]->next = bucket->pages;
+            bucket->pages = pages[p];
+        }
+        bucket->allocPage = NULL;
+        bucket->sweepCursor = bucket->pages;
+        evacuated += pageCount - needed;
+        free(pages);
+    }
+    return evacuated;
+}
+
+void heapReleaseEvacuated(Heap *heap)
+{
+    HeapPage *page = heap->evacuated;
+    while (page != NULL)
+    {
+        HeapPage *next = page->next;
+        unmapPage(page->base);
+        free(page);
+        heap->pageCount--;
+        page = next;
+    }
+    heap->evacuated = NULL;
+}
+
+// Gives the memory of empty, swept pages back to the OS. The descriptor and the
+// first OS page (which holds the descriptor pointer) stay, so the page can be
+// refilled from its bump index without mapping it again.
+int heapReleaseEmpty(Heap *heap)
+{
+    size_t osPage = (size_t)sysconf(_SC_PAGESIZE);
+    int released = 0;
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        for (HeapPage *page = heap->classes[i].pages; page != NULL; page = page->next)
+        {
+            if (!page->swept || page->liveCount > 0 || page->released)
+            {
+                continue;
+            }
+            madvise(page->base + osPage, HEAP_PAGE_SIZE - osPage, MADV_DONTNEED);
+            page->freeList = NULL;
+            page->bumpIndex = 0;
+            page->released = true;
+            released++;
+        }
+    }
+    heap->pagesReleased += released;
+    return released;
+}
+
+void heapVisitObjects(Heap *heap, void (*visit)(Obj *object))
+{
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        for (HeapPage *page = heap->classes[i].pages; page != NULL; page = page->next)
+        {
+            for (int slot = 0; slot < page->bumpIndex; slot++)
+            {
+                Obj *object = slotAt(page, slot);
+                int granule = heapGranuleOf(page, object);
+                if ((page->allocBits[granule >> 6] >> (granule & 63)) & 1)
+                {
+                    visit(object);
+                }
+            }
+        }
+    }
+}
+
+void freeHeap(Heap *heap, bool finalize)
+{
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        HeapPage *page = heap->classes[i].pages;
+        while (page != NULL)
+        {
+            HeapPage *next = page->next;
+            for (int slot = 0; finalize && slot < page->bumpIndex; slot++)
+            {
+                Obj *object = slotAt(page, slot);
+                int granule = heapGranuleOf(page, object);
+                if ((page->allocBits[granule >> 6] >> (granule & 63)) & 1)
+                {
+                    freeObject(object);
+                }
+            }
+            unmapPage(page->base);
+            free(page);
+            page = next;
+        }
+    }
+    initHeap(heap);
+}
@@ -0,0 +1,119 @@
+#ifndef clox_heap_h
+#define clox_heap_h
+
+#include "common.h"
+#include "value.h"
+
+// Objects live in fixed-size, page-aligned pages. Each page only holds slots
+// of a single size class, so a page can be swept on its own. The mark and
+// allocation bits are kept in side bitmaps owned by the page descriptor
+// (allocated apart from the page memory), so marking never writes into the
+// objects themselves.
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_GRANULE 16
+#define HEAP_GRANULE_SHIFT 4
+#define HEAP_PAGE_HEADER HEAP_GRANULE // first granule holds the descriptor pointer
+#define HEAP_MAX_SMALL_SIZE 256
+#define HEAP_SIZE_CLASSES (HEAP_MAX_SMALL_SIZE / HEAP_GRANULE)
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_GRANULE / 64)
+
+typedef struct HeapPage
+{
+    struct HeapPage *next; // next page of the same size class
+    struct HeapPage *nextReusable;
+    char *base;            // page memory (HEAP_PAGE_SIZE aligned)
+    int sizeClass;
+    int slotSize;
+    int slotCount;
+    int bumpIndex; // slots at or above this index were never handed out
+    int liveCount;
+    bool swept;
+    bool evacuating; // live objects were moved out, slots hold forwarding pointers
+    bool released;   // memory was handed back to the OS while the page was empty
+    bool reusable;   // queued on the class after a slot was freed outside of sweeping
+    Obj *freeList; // link is stored in the first word of each free slot
+    uint64_t markBits[HEAP_BITMAP_WORDS];
+    uint64_t allocBits[HEAP_BITMAP_WORDS];
+} HeapPage;
+
+typedef struct
+{
+    HeapPage *pages;
+    HeapPage *allocPage;   // page currently serving allocations
+    HeapPage *sweepCursor; // next page that may still need sweeping
+    HeapPage *reusable;    // swept pages that got slots back from reference counting
+} HeapClass;
+
+typedef struct
+{
+    HeapClass classes[HEAP_SIZE_CLASSES];
+    HeapPage *evacuated; // pages emptied by compaction, released once references are updated
+    int pageCount;
+    int pagesReleased;
+} Heap;
+
+#ifdef COMPRESSED_REFS
+// Every page is carved out of one reserved region, so a reference between
+// objects can be stored as a 32 bit offset in granules from its start. The
+// first granule of the region is a page header, which leaves 0 for NULL.
+#define HEAP_RESERVE_SIZE ((size_t)32 << 30)
+
+extern char *heapRegion;
+
+static inline uint32_t heapCompress(void *object)
+{
+    return object == NULL ? 0 : (uint32_t)(((char *)object - heapRegion) >> HEAP_GRANULE_SHIFT);
+}
+
+static inline void *heapDecompress(uint32_t ref)
+{
+    return ref == 0 ? NULL : heapRegion + ((size_t)ref << HEAP_GRANULE_SHIFT);
+}
+#endif
+
+static inline HeapPage *heapPageOf(Obj *object)
+{
+    return *(HeapPage **)((uintptr_t)object & ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+}
+
+static inline int heapGranuleOf(HeapPage *page, Obj *object)
+{
+    return (int)(((char *)object - page->base) >> HEAP_GRANULE_SHIFT);
+}
+
+static inline bool heapIsMarked(Obj *object)
+{
+    HeapPage *page = heapPageOf(object);
+    int granule = heapGranuleOf(page, object);
+    return (page->markBits[granule >> 6] >> (granule & 63)) & 1;
+}
+
+// sets the mark bit and returns whether it was already set
+static inline bool heapTestAndMark(Obj *object)
+{
+    HeapPage *page = heapPageOf(object);
+    int granule = heapGranuleOf(page, object);
+    uint64_t bit = (uint64_t)1 << (granule & 63);
+    if (page->markBits[granule >> 6] & bit)
+    {
+        return true;
+    }
+    page->markBits[granule >> 6] |= bit;
+    return false;
+}
+
+void initHeap(Heap *heap);
+void freeHeap(Heap *heap, bool finalize);
+int heapSlotSize(size_t size);
+Obj *heapAllocate(Heap *heap, size_t size);
+void heapFreeSlot(Heap *heap, Obj *object);
+void heapFinishSweep(Heap *heap);
+bool heapSweepUntil(Heap *heap, double deadlineMs);
+void heapStartSweep(Heap *heap);
+double heapFragmentation(Heap *heap);
+int heapEvacuate(Heap *heap);
+void heapReleaseEvacuated(Heap *heap);
+int heapReleaseEmpty(Heap *heap);
+void heapVisitObjects(Heap *heap, void (*visit)(Obj *object));
+
+#endif
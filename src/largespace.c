@@ -0,0 +1,127 @@
+#define _GNU_SOURCE // mremap
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "largespace.h"
+
+// keeps the payload 16 byte aligned like malloc does
+#define LARGE_HEADER_SIZE ((sizeof(LargeObject) + 15) & ~(size_t)15)
+
+static size_t mappedSize(size_t size)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return (LARGE_HEADER_SIZE + size + pageSize - 1) & ~(pageSize - 1);
+}
+
+static inline LargeObject *headerOf(void *pointer)
+{
+    return (LargeObject *)((char *)pointer - LARGE_HEADER_SIZE);
+}
+
+static void linkObject(LargeSpace *space, LargeObject *object)
+{
+    object->prev = NULL;
+    object->next = space->objects;
+    if (space->objects != NULL)
+    {
+        space->objects->prev = object;
+    }
+    space->objects = object;
+}
+
+static void unlinkObject(LargeSpace *space, LargeObject *object)
+{
+    if (object->prev != NULL)
+    {
+        object->prev->next = object->next;
+    }
+    else
+    {
+        space->objects = object->next;
+    }
+    if (object->next != NULL)
+    {
+        object->next->prev = object->prev;
+    }
+}
+
+void initLargeSpace(LargeSpace *space, size_t threshold)
+{
+    space->objects = NULL;
+    space->threshold = threshold;
+    space->count = 0;
+    space->mappedBytes = 0;
+    space->remaps = 0;
+    space->remapsMoved = 0;
+}
+
+void freeLargeSpace(LargeSpace *space)
+{
+    LargeObject *object = space->objects;
+    while (object != NULL)
+    {
+        LargeObject *next = object->next;
+        munmap(object, object->size);
+        object = next;
+    }
+    initLargeSpace(space, space->threshold);
+}
+
+void *largeAllocate(LargeSpace *space, size_t size, uint32_t flags)
+{
+    size_t mapped = mappedSize(size);
+    void *memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    LargeObject *object = (LargeObject *)memory;
+    object->size = mapped;
+    object->flags = flags;
+    linkObject(space, object);
+    space->count++;
+    space->mappedBytes += mapped;
+    return (char *)object + LARGE_HEADER_SIZE;
+}
+
+void *largeReallocate(LargeSpace *space, void *pointer, size_t newSize)
+{
+    LargeObject *object = headerOf(pointer);
+    size_t mapped = mappedSize(newSize);
+    if (mapped == object->size)
+    {
+        return pointer;
+    }
+    size_t oldMapped = object->size;
+    // try to extend the mapping where it is first, the neighbours stay linked
+    LargeObject *resized = mremap(object, oldMapped, mapped, 0);
+    if (resized == MAP_FAILED)
+    {
+        // the kernel moves the pages, the bytes themselves are never copied
+        unlinkObject(space, object);
+        resized = mremap(object, oldMapped, mapped, MREMAP_MAYMOVE);
+        if (resized == MAP_FAILED)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+        linkObject(space, resized);
+        space->remapsMoved++;
+    }
+    resized->size = mapped;
+    space->remaps++;
+    space->mappedBytes += mapped - oldMapped;
+    return (char *)resized + LARGE_HEADER_SIZE;
+}
+
+void largeFree(LargeSpace *space, void *pointer)
+{
+    LargeObject *object = headerOf(pointer);
+    unlinkObject(space, object);
+    space->count--;
+    space->mappedBytes -= object->size;
+    munmap(object, object->size);
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef clox_largespace_h
+#define clox_largespace_h
+
+#include "common.h"
+
+// Buffers at or above the threshold get their own mapping instead of going
+// through malloc. They are never moved by the collector, grow with mremap
+// (in place when the address space allows it) and are kept on a list of
+// their own so they can all be dropped at shutdown. Whether a buffer lives
+// here is decided by its size alone, so callers never need to tag it.
+#define LARGE_BUFFER 0x1
+
+typedef struct LargeObject
+{
+    struct LargeObject *next;
+    struct LargeObject *prev;
+    size_t size; // bytes mapped, header included
+    uint32_t flags;
+} LargeObject;
+
+typedef struct
+{
+    LargeObject *objects;
+    size_t threshold;
+    size_t count;
+    size_t mappedBytes;
+    size_t remaps;      // growth steps served by mremap
+    size_t remapsMoved; // ... that had to move to a new address
+} LargeSpace;
+
+static inline bool isLargeSize(LargeSpace *space, size_t size)
+{
+    return size >= space->threshold;
+}
+
+void initLargeSpace(LargeSpace *space, size_t threshold);
+void freeLargeSpace(LargeSpace *space);
+void *largeAllocate(LargeSpace *space, size_t size, uint32_t flags);
+void *largeReallocate(LargeSpace *space, void *pointer, size_t newSize);
+void largeFree(LargeSpace *space, void *pointer);
+
+#endif
\ No newline at end of file
@@ -3,6 +3,11 @@
 #include <string.h>
 #include "common.h"
 #include "util.h"
+#include "config.h"
+#include "hash.h"
+#include "stringlib.h"
+#include "number.h"
+#include "table.h"
 
 void tokenize(const char *path);
 void parse(const char *path);
@@ -16,9 +21,33 @@ int main(int argc, char *argv[])
     setbuf(stdout, NULL);
     setbuf(stderr, NULL);
 
+    // options can appear anywhere, everything else is positional
+    initConfig();
+    loadEnvironment();
+    int count = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            argv[++count] = argv[i];
+        }
+        else if (!parseOption(argv[i]))
+        {
+            fprintf(stderr, "Unknown or invalid option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!checkOptions())
+    {
+        return 1;
+    }
+    argc = count + 1;
+    initHash(config.hashSeed);
+    initStringLib();
+
     if (argc < 2)
     {
-        fprintf(stderr, "Usage: ./your_program <command> [<filename>]\n");
+        fprintf(stderr, "Usage: ./your_program <command> [<filename>...] [--options]\n");
         return 1;
     }
 
@@ -40,6 +69,10 @@ int main(int argc, char *argv[])
     {
         runFile(argv[2]);
     }
+    else if (strcmp(command, "batch") == 0)
+    {
+        return runBatch(argc - 2, (const char **)argv + 2);
+    }
     else if (strcmp(command, "testchunk") == 0)
     {
         testChunk();
@@ -52,6 +85,22 @@ int main(int argc, char *argv[])
     {
         testHashTable();
     }
+    else if (strcmp(command, "benchhash") == 0)
+    {
+        benchHash();
+    }
+    else if (strcmp(command, "benchstrings") == 0)
+    {
+        benchStrings();
+    }
+    else if (strcmp(command, "benchnumbers") == 0)
+    {
+        benchNumbers();
+    }
+    else if (strcmp(command, "benchtable") == 0)
+    {
+        benchTable();
+    }
     else
     {
         fprintf(stderr, "Unknown command: %s\n", command);
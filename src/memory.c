@@ -1,15 +1,70 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "common.h"
 #include "memory.h"
 #include "compiler.h"
 #include "debug.h"
+#include "config.h"
+#include "gcstats.h"
+#include "pacer.h"
+#include "freer.h"
+#include "arena.h"
+#include "largespace.h"
+#include "rc.h"
+#include "gctrace.h"
+
+static bool deferFrees = false; // set while freeObject runs with the free thread enabled
+
+// moves a buffer into, within or out of the large-object space
+static void *resizeLarge(void *pointer, size_t oldSize, size_t newSize)
+{
+    LargeSpace *space = &vm.largeSpace;
+    if (isLargeSize(space, oldSize) && isLargeSize(space, newSize))
+    {
+        return largeReallocate(space, pointer, newSize);
+    }
+    void *result = NULL;
+    if (isLargeSize(space, newSize))
+    {
+        result = largeAllocate(space, newSize, LARGE_BUFFER);
+    }
+    else if (newSize > 0)
+    {
+        result = malloc(newSize);
+        if (result == NULL)
+        {
+            exit(1);
+        }
+    }
+    if (pointer != NULL && result != NULL)
+    {
+        memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+    }
+    if (isLargeSize(space, oldSize))
+    {
+        largeFree(space, pointer);
+    }
+    else if (!arenaOwns(pointer))
+    {
+        free(pointer);
+    }
+    return result;
+}
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize)
 {
+    if (gcTracing())
+    {
+        gcTraceBytes(oldSize, newSize);
+    }
     vm.bytesAllocated += newSize - oldSize;
     if (newSize > oldSize)
     {
+        gcStats.bytesAllocated += newSize - oldSize;
 #ifdef DEBUG_STRESS_GC
         collectGarbage();
 #endif
@@ -18,12 +73,48 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize)
             collectGarbage();
         }
     }
+    else
+    {
+        gcStats.bytesFreed += oldSize - newSize;
+    }
+    if (isLargeSize(&vm.largeSpace, oldSize) || isLargeSize(&vm.largeSpace, newSize))
+    {
+        return resizeLarge(pointer, oldSize, newSize);
+    }
     if (newSize == 0)
     {
-        free(pointer);
+        if (arenaOwns(pointer))
+        {
+            return NULL; // released with the whole arena
+        }
+        if (deferFrees)
+        {
+            freerDefer(pointer);
+        }
+        else
+        {
+            free(pointer);
+        }
         return NULL;
     }
-    void *result = realloc(pointer, newSize);
+    void *result = arenaReallocate(pointer, oldSize, newSize);
+    if (result != NULL)
+    {
+        return result;
+    }
+    if (arenaOwns(pointer))
+    {
+        // the arena is closed, move the buffer out to malloc
+        result = malloc(newSize);
+        if (result != NULL)
+        {
+            memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+        }
+    }
+    else
+    {
+        result = realloc(pointer, newSize);
+    }
     if (result == NULL)
     {
         exit(1);
@@ -31,75 +122,169 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize)
     return result;
 }
 
-static void freeObject(Obj *object)
+Obj *allocateSlot(size_t size)
+{
+    if (rcEnabled())
+    {
+#ifdef DEBUG_STRESS_GC
+        rcReconcile();
+#else
+        if (rc.zctCount >= RC_ZCT_LIMIT || vm.bytesAllocated > rc.bytesAtReconcile + RC_BYTES_LIMIT)
+        {
+            rcReconcile();
+        }
+#endif
+    }
+    vm.bytesAllocated += heapSlotSize(size);
+    gcStats.bytesAllocated += heapSlotSize(size);
+#ifdef DEBUG_STRESS_GC
+    collectGarbage();
+#endif
+    if (vm.bytesAllocated > vm.nextGC)
+    {
+        collectGarbage();
+    }
+    return heapAllocate(&vm.heap, size);
+}
+
+// reference counting may free a view that is waiting to be detached
+static void forgetView(ObjView *view)
+{
+    for (int i = 0; i < vm.viewCount; i++)
+    {
+        if (vm.views[i] == view)
+        {
+            vm.views[i] = vm.views[--vm.viewCount];
+            return;
+        }
+    }
+}
+
+// releases the buffers owned by the object, the slot itself is reused by the heap
+void freeObject(Obj *object)
 {
 #ifdef DEBUG_LOG_GC
     printf("%p free type %d\n", object, object->type);
 #endif
+    deferFrees = config.gcFreeThread;
     switch (object->type)
     {
     case OBJ_STRING:
     {
         ObjString *string = (ObjString *)object;
-        FREE_ARRAY(char, string->chars, string->length + 1);
-        FREE(ObjString, object);
+        if (!stringIsInline(string->length))
+        {
+            FREE_ARRAY(char, string->chars, string->length + 1);
+            gcStatsResize(OBJ_STRING, string->length + 1, 0);
+        }
         break;
     }
-    case OBJ_NATIVE:
+    case OBJ_VIEW:
     {
-        FREE(ObjNative, object);
+        ObjView *view = (ObjView *)object;
+        if (!view->parent)
+        {
+            FREE_ARRAY(char, view->chars, view->length + 1);
+            gcStatsResize(OBJ_VIEW, view->length + 1, 0);
+        }
+        forgetView(view);
         break;
     }
     case OBJ_FUNCTION:
     {
         ObjFunction *function = (ObjFunction *)object;
         freeChunk(&function->chunk);
-        FREE(ObjFunction, object);
         break;
     }
     case OBJ_CLOSURE:
     {
         ObjClosure *closure = (ObjClosure *)object;
-        FREE_ARRAY(ObjUpvalue *, closure->upvalues, closure->upvalueCount);
-        FREE(ObjClosure, object);
-        break;
-    }
-    case OBJ_UPVALUE:
-    {
-        FREE(ObjUpvalue, object);
+        if (!closureIsInline(closure->upvalueCount))
+        {
+            FREE_ARRAY(REF(ObjUpvalue), closure->upvalues, closure->upvalueCount);
+            gcStatsResize(OBJ_CLOSURE, sizeof(REF(ObjUpvalue)) * closure->upvalueCount, 0);
+        }
         break;
     }
     case OBJ_CLASS:
     {
         ObjClass *klass = (ObjClass *)object;
-        freeTable(&klass->methods);
-        FREE(ObjClass, object);
+        FREE_ARRAY(REF(ObjClosure), klass->vtable, klass->vtableSize);
+        gcStatsResize(OBJ_CLASS, sizeof(REF(ObjClosure)) * klass->vtableSize, 0);
         break;
     }
     case OBJ_INSTANCE:
     {
         ObjInstance *instance = (ObjInstance *)object;
         freeTable(&instance->fields);
-        FREE(ObjInstance, object);
         break;
     }
+    case OBJ_NATIVE:
+    case OBJ_ROPE:
+    case OBJ_UPVALUE:
     case OBJ_BOUND_METHOD:
+        break;
+    }
+    deferFrees = false;
+    size_t slotSize = heapPageOf(object)->slotSize;
+    vm.bytesAllocated -= slotSize;
+    gcStats.bytesFreed += slotSize;
+    gcStatsFree(object->type, slotSize);
+}
+
+// estimate of the memory kept alive by the object, used to pace the next GC
+static size_t objectSize(Obj *object)
+{
+    size_t size = heapPageOf(object)->slotSize;
+    switch (object->type)
     {
-        FREE(ObjBoundMethod, object);
+    case OBJ_STRING:
+        if (!stringIsInline(((ObjString *)object)->length))
+        {
+            size += ((ObjString *)object)->length + 1;
+        }
+        break;
+    case OBJ_VIEW:
+        if (!((ObjView *)object)->parent)
+        {
+            size += ((ObjView *)object)->length + 1;
+        }
+        break;
+    case OBJ_FUNCTION:
+    {
+        Chunk *chunk = &((ObjFunction *)object)->chunk;
+        size += chunk->capacity * (sizeof(uint8_t) + sizeof(int));
+        size += chunk->constants.capacity * sizeof(Value);
         break;
     }
+    case OBJ_CLOSURE:
+        if (!closureIsInline(((ObjClosure *)object)->upvalueCount))
+        {
+            size += ((ObjClosure *)object)->upvalueCount * sizeof(REF(ObjUpvalue));
+        }
+        break;
+    case OBJ_CLASS:
+        size += ((ObjClass *)object)->vtableSize * sizeof(REF(ObjClosure));
+        break;
+    case OBJ_INSTANCE:
+        size += tableSlots(&((ObjInstance *)object)->fields) * sizeof(Entry);
+        break;
+    case OBJ_NATIVE:
+    case OBJ_ROPE:
+    case OBJ_UPVALUE:
+    case OBJ_BOUND_METHOD:
+        break;
     }
+    return size;
 }
 
 void freeObjects()
 {
-    Obj *object = vm.objects;
-    while (object != NULL)
-    {
-        Obj *next = object->next;
-        freeObject(object);
-        object = next;
-    }
+    // while the arena is open every owned buffer lives in it, so the pages
+    // can be dropped without visiting each object
+    freeHeap(&vm.heap, !arena.open);
+    freeArena();
+    freeLargeSpace(&vm.largeSpace);
 }
 
 void markObject(Obj *object)
@@ -108,16 +293,16 @@ void markObject(Obj *object)
     {
         return;
     }
-    if (object->isMarked)
+    if (heapTestAndMark(object))
     {
         return;
     }
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", object);
     printValue(OBJ_VAL(object));
+    flushOutput(&vm.output);
     printf("\n");
 #endif
-    object->isMarked = true;
     if (vm.grayCapacity < vm.grayCount + 1)
     {
         vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
@@ -141,9 +326,9 @@ void markValue(Value value)
 
 static void markTable(Table *table)
 {
-    for (int i = 0; i < table->capacity; i++)
+    for (int i = 0; i < tableSlots(table); i++)
     {
-        Entry *entry = &table->entries[i];
+        Entry *entry = tableSlot(table, i);
         markObject((Obj *)entry->key);
         markValue(entry->value);
     }
@@ -170,7 +355,7 @@ static void markRoots()
         markObject((Obj *)vm.frames[i].closure);
     }
     // open upvalues
-    for (ObjUpvalue *upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+    for (ObjUpvalue *upvalue = vm.openUpvalues; upvalue != NULL; upvalue = DEREF(ObjUpvalue, upvalue->next))
     {
         markObject((Obj *)upvalue);
     }
@@ -180,13 +365,31 @@ static void markRoots()
     markCompilerRoots();
 }
 
+static void recordView(ObjView *view)
+{
+    if (vm.viewCapacity < vm.viewCount + 1)
+    {
+        vm.viewCapacity = GROW_CAPACITY(vm.viewCapacity);
+        vm.views = (ObjView **)realloc(vm.views, sizeof(ObjView *) * vm.viewCapacity);
+    }
+    if (vm.views == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    vm.views[vm.viewCount++] = view;
+}
+
 static void blackenObject(Obj *object)
 {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", object);
     printValue(OBJ_VAL(object));
+    flushOutput(&vm.output);
     printf("\n");
 #endif
+    vm.bytesMarked += objectSize(object);
+    vm.objectsMarked++;
     switch (object->type)
     {
     case OBJ_UPVALUE:
@@ -195,31 +398,36 @@ static void blackenObject(Obj *object)
     case OBJ_FUNCTION:
     {
         ObjFunction *function = (ObjFunction *)object;
-        markObject((Obj *)function->name);
+        markObject((Obj *)DEREF(ObjString, function->name));
         markArray(&function->chunk.constants);
         break;
     }
     case OBJ_CLOSURE:
     {
         ObjClosure *closure = (ObjClosure *)object;
-        markObject((Obj *)closure->function);
+        markObject((Obj *)DEREF(ObjFunction, closure->function));
         for (int i = 0; i < closure->upvalueCount; i++)
         {
-            markObject((Obj *)closure->upvalues[i]);
+            markObject((Obj *)DEREF(ObjUpvalue, closure->upvalues[i]));
         }
         break;
     }
     case OBJ_CLASS:
     {
         ObjClass *klass = (ObjClass *)object;
-        markObject((Obj *)klass->name);
-        markTable(&klass->methods);
+        markObject((Obj *)DEREF(ObjString, klass->name));
+        markObject((Obj *)DEREF(ObjClass, klass->superclass));
+        markObject((Obj *)DEREF(ObjClosure, klass->initializer));
+        for (int i = 0; i < klass->vtableSize; i++)
+        {
+            markObject((Obj *)DEREF(ObjClosure, klass->vtable[i]));
+        }
         break;
     }
     case OBJ_INSTANCE:
     {
         ObjInstance *instance = (ObjInstance *)object;
-        markObject((Obj *)instance->klass);
+        markObject((Obj *)DEREF(ObjClass, instance->klass));
         markTable(&instance->fields);
         break;
     }
@@ -227,7 +435,24 @@ static void blackenObject(Obj *object)
     {
         ObjBoundMethod *bound = (ObjBoundMethod *)object;
         markValue(bound->receiver);
-        markObject((Obj *)bound->method);
+        markObject((Obj *)DEREF(ObjClosure, bound->method));
+        break;
+    }
+    case OBJ_ROPE:
+    {
+        ObjRope *rope = (ObjRope *)object;
+        markObject((Obj *)DEREF(ObjString, rope->left));
+        markObject((Obj *)DEREF(ObjString, rope->right));
+        markObject((Obj *)DEREF(ObjString, rope->flat));
+        break;
+    }
+    case OBJ_VIEW:
+    {
+        ObjView *view = (ObjView *)object;
+        if (view->parent)
+        {
+            recordView(view); // the parent is marked by markViewParents()
+        }
         break;
     }
     case OBJ_NATIVE:
@@ -236,60 +461,398 @@ static void blackenObject(Obj *object)
     }
 }
 
-static void traceReferences()
+// second prefetch stage: by the time an object is close to the head of the
+// FIFO its header is cached, so the buffer holding its references can be
+// requested without stalling
+static inline void prefetchReferences(Obj *object)
 {
-    while (vm.grayCount > 0)
+    switch (object->type)
     {
-        Obj *object = vm.grayMarks[--vm.grayCount];
-        blackenObject(object);
+    case OBJ_INSTANCE:
+        PREFETCH(((ObjInstance *)object)->fields.entries);
+        break;
+    case OBJ_CLASS:
+        PREFETCH(((ObjClass *)object)->vtable);
+        break;
+    case OBJ_CLOSURE:
+        if (!closureIsInline(((ObjClosure *)object)->upvalueCount))
+        {
+            PREFETCH(((ObjClosure *)object)->upvalues);
+        }
+        break;
+    case OBJ_FUNCTION:
+        PREFETCH(((ObjFunction *)object)->chunk.constants.values);
+        break;
+    default:
+        break;
     }
 }
 
-static void sweep()
+static void traceReferences()
 {
-    Obj *previous = NULL;
-    Obj *object = vm.objects;
-    while (object != NULL)
+    int depth = config.gcMarkPrefetch;
+    if (depth == 0)
     {
-        if (object->isMarked)
+        while (vm.grayCount > 0)
         {
-            object->isMarked = false; // clear flag for next GC round
-            previous = object;
-            object = object->next;
+            Obj *object = vm.grayMarks[--vm.grayCount];
+            blackenObject(object);
         }
-        else
+        return;
+    }
+    // gray objects wait in a small FIFO after being prefetched, so by the time
+    // one is blackened its fields are likely in cache instead of each object
+    // costing a serial miss
+    Obj *fifo[GC_MARK_PREFETCH_MAX];
+    unsigned int head = 0;
+    unsigned int tail = 0;
+    for (;;)
+    {
+        while (tail - head < (unsigned int)depth && vm.grayCount > 0)
+        {
+            Obj *object = vm.grayMarks[--vm.grayCount];
+            PREFETCH(object);
+            fifo[tail++ & (GC_MARK_PREFETCH_MAX - 1)] = object;
+        }
+        if (head == tail)
+        {
+            break;
+        }
+        Obj *object = fifo[head++ & (GC_MARK_PREFETCH_MAX - 1)];
+        if (tail - head > (unsigned int)depth / 2)
         {
-            // remove object from list and free it
-            Obj *unreached = object;
-            object = object->next;
-            if (previous != NULL)
-            {
-                previous->next = object;
-            }
-            else
-            {
-                vm.objects = object;
-            }
-            freeObject(unreached);
+            prefetchReferences(fifo[(head + depth / 2) & (GC_MARK_PREFETCH_MAX - 1)]);
         }
+        blackenObject(object);
     }
 }
 
+// Views keep their parents alive, but only once everything else is traced, so
+// a parent nothing else refers to can be told apart. The views holding such a
+// parent for a small slice are left in vm.views, detachViews() copies their
+// characters at the next safepoint and the parent goes in a later collection.
+static void markViewParents()
+{
+    int detach = 0;
+    for (int i = 0; i < vm.viewCount; i++)
+    {
+        ObjView *view = vm.views[i];
+        ObjString *parent = DEREF(ObjString, view->parent);
+        if (!heapIsMarked((Obj *)parent) && view->length < parent->length / VIEW_DETACH_RATIO)
+        {
+            vm.views[i] = vm.views[detach];
+            vm.views[detach++] = view;
+        }
+    }
+    for (int i = 0; i < vm.viewCount; i++)
+    {
+        markObject((Obj *)DEREF(ObjString, vm.views[i]->parent));
+    }
+    traceReferences();
+    vm.viewCount = detach;
+}
+
+static void releaseMemory()
+{
+    heapReleaseEmpty(&vm.heap);
+#ifdef __GLIBC__
+    malloc_trim(0); // buffers freed through reallocate() stay in malloc otherwise
+#endif
+}
+
 void collectGarbage()
 {
 #ifdef DEBUG_LOG_GC
     printf("-- gc begin\n");
 #endif
+    double startMs = gcClockMs();
+    if (arena.open)
+    {
+        // the arena ceiling was reached, from here on the heap is collected as usual
+        closeArena();
+    }
+    // pages left over from the previous cycle must be swept before their mark bits are reused
+    heapFinishSweep(&vm.heap);
+#ifdef DEBUG_LOG_GC
     size_t before = vm.bytesAllocated;
+#endif
+    double markStartMs = gcClockMs();
+    gcStats.sweepTotalMs += markStartMs - startMs; // finishing the sweep is not marking
+    vm.bytesMarked = (tableSlots(&vm.globals) + tableSlots(&vm.strings)) * sizeof(Entry);
+    vm.objectsMarked = 0;
+    vm.viewCount = 0; // the views left from the previous cycle may be dead by now
     markRoots();
     traceReferences();
+    markViewParents();
+    double markEndMs = gcClockMs();
+    if (rcEnabled())
+    {
+        rcAfterMark();
+    }
     tableRemoveWhite(&vm.strings);
-    sweep();
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    // dead objects are reclaimed lazily, page by page, as the allocator needs slots
+    heapStartSweep(&vm.heap);
+    if (pacerNearLimit())
+    {
+        // major collection: sweep now and give the free memory back
+        heapFinishSweep(&vm.heap);
+        releaseMemory();
+    }
+    vm.nextGC = pacerNextGC(startMs, gcClockMs());
+    if (config.gcCompact)
+    {
+#ifdef DEBUG_STRESS_GC
+        vm.compactPending = true;
+#else
+        // compaction moves objects, so it waits for the interpreter to reach a safepoint
+        vm.compactPending = heapFragmentation(&vm.heap) > config.gcCompactThreshold;
+#endif
+    }
+    gcStatsCollection(startMs, markStartMs, markEndMs, vm.objectsMarked);
+    if (gcTracing())
+    {
+        gcTraceCollection(vm.objectsMarked, vm.bytesMarked, markEndMs - markStartMs, gcStats.pauseLastMs);
+        if (gcTrace.precision > 0 && vm.nextGC > vm.bytesAllocated + gcTrace.precision)
+        {
+            // precision collections narrow down when each object died
+            vm.nextGC = vm.bytesAllocated + gcTrace.precision;
+        }
+    }
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
-    size_t freed = before - vm.bytesAllocated;
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-           freed, before, vm.bytesAllocated, vm.nextGC);
+    printf("   marked %zu bytes (heap at %zu) next at %zu\n",
+           vm.bytesMarked, before, vm.nextGC);
 #endif
 }
+
+Obj *forwardObject(Obj *object)
+{
+    if (object != NULL && heapPageOf(object)->evacuating)
+    {
+        return *(Obj **)object;
+    }
+    return object;
+}
+
+static void forwardValue(Value *value)
+{
+    if (IS_OBJ(*value))
+    {
+        value->as.obj = forwardObject(AS_OBJ(*value));
+    }
+}
+
+static void forwardTable(Table *table)
+{
+    for (int i = 0; i < tableSlots(table); i++)
+    {
+        Entry *entry = tableSlot(table, i);
+        // keys keep their hash, so entries stay in the same bucket
+        entry->key = (ObjString *)forwardObject((Obj *)entry->key);
+        forwardValue(&entry->value);
+    }
+}
+
+static void forwardReferences(Obj *object)
+{
+    switch (object->type)
+    {
+    case OBJ_UPVALUE:
+    {
+        ObjUpvalue *upvalue = (ObjUpvalue *)object;
+        forwardValue(&upvalue->closed);
+        upvalue->next = TO_REF((ObjUpvalue *)forwardObject((Obj *)DEREF(ObjUpvalue, upvalue->next)));
+        // a closed upvalue points at its own storage, which may have moved with it
+        if (upvalue->location < vm.stack || upvalue->location >= vm.stack + STACK_MAX)
+        {
+            upvalue->location = &upvalue->closed;
+        }
+        break;
+    }
+    case OBJ_FUNCTION:
+    {
+        ObjFunction *function = (ObjFunction *)object;
+        function->name = TO_REF((ObjString *)forwardObject((Obj *)DEREF(ObjString, function->name)));
+        for (int i = 0; i < function->chunk.constants.count; i++)
+        {
+            forwardValue(&function->chunk.constants.values[i]);
+        }
+        break;
+    }
+    case OBJ_CLOSURE:
+    {
+        ObjClosure *closure = (ObjClosure *)object;
+        closure->function = TO_REF((ObjFunction *)forwardObject((Obj *)DEREF(ObjFunction, closure->function)));
+        if (closureIsInline(closure->upvalueCount))
+        {
+            closure->upvalues = closure->inlineUpvalues; // moved along with the closure
+        }
+        for (int i = 0; i < closure->upvalueCount; i++)
+        {
+            closure->upvalues[i] = TO_REF((ObjUpvalue *)forwardObject((Obj *)DEREF(ObjUpvalue, closure->upvalues[i])));
+        }
+        break;
+    }
+    case OBJ_CLASS:
+    {
+        ObjClass *klass = (ObjClass *)object;
+        klass->name = TO_REF((ObjString *)forwardObject((Obj *)DEREF(ObjString, klass->name)));
+        klass->superclass = TO_REF((ObjClass *)forwardObject((Obj *)DEREF(ObjClass, klass->superclass)));
+        klass->initializer = TO_REF((ObjClosure *)forwardObject((Obj *)DEREF(ObjClosure, klass->initializer)));
+        for (int i = 0; i < klass->vtableSize; i++)
+        {
+            klass->vtable[i] = TO_REF((ObjClosure *)forwardObject((Obj *)DEREF(ObjClosure, klass->vtable[i])));
+        }
+        break;
+    }
+    case OBJ_INSTANCE:
+    {
+        ObjInstance *instance = (ObjInstance *)object;
+        instance->klass = TO_REF((ObjClass *)forwardObject((Obj *)DEREF(ObjClass, instance->klass)));
+        forwardTable(&instance->fields);
+        break;
+    }
+    case OBJ_BOUND_METHOD:
+    {
+        ObjBoundMethod *bound = (ObjBoundMethod *)object;
+        forwardValue(&bound->receiver);
+        bound->method = TO_REF((ObjClosure *)forwardObject((Obj *)DEREF(ObjClosure, bound->method)));
+        break;
+    }
+    case OBJ_STRING:
+    {
+        ObjString *string = (ObjString *)object;
+        if (stringIsInline(string->length))
+        {
+            string->chars = string->inlineChars; // moved along with the string
+        }
+        break;
+    }
+    case OBJ_ROPE:
+    {
+        ObjRope *rope = (ObjRope *)object;
+        rope->left = TO_REF((ObjString *)forwardObject((Obj *)DEREF(ObjString, rope->left)));
+        rope->right = TO_REF((ObjString *)forwardObject((Obj *)DEREF(ObjString, rope->right)));
+        rope->flat = TO_REF((ObjString *)forwardObject((Obj *)DEREF(ObjString, rope->flat)));
+        if (rope->flat)
+        {
+            rope->chars = DEREF(ObjString, rope->flat)->chars;
+        }
+        break;
+    }
+    case OBJ_VIEW:
+    {
+        // parents keep their characters where they are, so chars stays valid
+        ObjView *view = (ObjView *)object;
+        view->parent = TO_REF((ObjString *)forwardObject((Obj *)DEREF(ObjString, view->parent)));
+        break;
+    }
+    case OBJ_NATIVE:
+        break;
+    }
+}
+
+static void forwardRoots()
+{
+    for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+    {
+        forwardValue(slot);
+    }
+    for (int i = 0; i < vm.frameCount; i++)
+    {
+        vm.frames[i].closure = (ObjClosure *)forwardObject((Obj *)vm.frames[i].closure);
+    }
+    vm.openUpvalues = (ObjUpvalue *)forwardObject((Obj *)vm.openUpvalues);
+    forwardTable(&vm.globals);
+    forwardTable(&vm.strings);
+    vm.initString = (ObjString *)forwardObject((Obj *)vm.initString);
+    forwardCompilerRoots();
+    for (int i = 0; i < rc.zctCount; i++)
+    {
+        rc.zct[i] = forwardObject(rc.zct[i]);
+    }
+}
+
+// Does collector work the host would otherwise pay for at the next
+// allocation trigger: reference count reconciliation, the rest of the lazy
+// sweep and, when the heap has grown enough and the last pause fits in the
+// remaining budget, a full collection that moves the trigger out again.
+// Returns the milliseconds spent.
+double gcIdle(double budgetMs)
+{
+    double startMs = gcClockMs();
+    double deadlineMs = startMs + budgetMs;
+    if (rcEnabled())
+    {
+        rcReconcile();
+    }
+    if (heapSweepUntil(&vm.heap, deadlineMs))
+    {
+        // skip it unless at least a quarter of the way to the trigger was allocated
+        size_t grown = vm.bytesAllocated > vm.bytesMarked ? vm.bytesAllocated - vm.bytesMarked : 0;
+        size_t runway = vm.nextGC > vm.bytesMarked ? vm.nextGC - vm.bytesMarked : 0;
+        if (grown > 0 && grown >= runway / 4 && gcClockMs() + gcStats.pauseLastMs <= deadlineMs)
+        {
+            collectGarbage();
+            gcStats.idleCollections++;
+            heapSweepUntil(&vm.heap, deadlineMs);
+        }
+    }
+    double spentMs = gcClockMs() - startMs;
+    gcStats.idleTotalMs += spentMs;
+    return spentMs;
+}
+
+// Full collection followed by evacuation of the sparsest pages. Objects move,
+// so this must only run where no C local holds an object pointer.
+void compactHeap()
+{
+    double startMs = gcClockMs();
+    collectGarbage();
+    detachViews(); // the list would not follow the views being moved
+    vm.compactPending = false;
+    heapFinishSweep(&vm.heap);
+    if (heapEvacuate(&vm.heap) == 0)
+    {
+        return;
+    }
+    forwardRoots();
+    heapVisitObjects(&vm.heap, forwardReferences);
+    heapReleaseEvacuated(&vm.heap);
+    releaseMemory();
+    gcStats.compactions++;
+    gcStats.compactTotalMs += gcClockMs() - startMs;
+    if (config.gcLog)
+    {
+        fprintf(stderr, "[gc %d] compacted to %d pages\n", gcStats.collections, vm.heap.pageCount);
+    }
+#ifdef DEBUG_LOG_GC
+    printf("-- gc compacted to %d pages\n", vm.heap.pageCount);
+#endif
+}
+
+// Gives the views that markViewParents() picked a copy of their characters.
+// Runs at a safepoint like compaction, since C code may be holding on to the
+// characters of a view while it allocates.
+void detachViews()
+{
+    while (vm.viewCount > 0)
+    {
+        ObjView *view = vm.views[--vm.viewCount];
+        if (!view->parent)
+        {
+            continue; // listed again by a collection while the previous one was copied
+        }
+        push(OBJ_VAL(view));
+        char *chars = ALLOCATE(char, view->length + 1); // a collection here refills the list
+        memcpy(chars, view->chars, view->length);
+        chars[view->length] = '\0';
+        rcWrite((Obj *)view, OBJ_VAL(DEREF(ObjString, view->parent)), NIL_VAL);
+        view->parent = TO_REF(NULL);
+        view->chars = chars;
+        view->offset = 0;
+        gcStatsResize(OBJ_VIEW, 0, view->length + 1);
+        gcStats.viewsDetached++;
+        pop();
+    }
+}
\ No newline at end of file
@@ -4,8 +4,6 @@
 #include "object.h"
 #include "vm.h"
 
-#define GC_HEAP_GROW_FACTOR 2
-
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 #define GROW_ARRAY(type, pointer, oldCount, newCount) \
     (type *)reallocate(pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
@@ -17,9 +15,15 @@
     (type *)reallocate(NULL, 0, sizeof(type) * count)
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+Obj *allocateSlot(size_t size);
+void freeObject(Obj *object);
 void freeObjects();
 void markObject(Obj *object);
 void markValue(Value value);
 void collectGarbage();
+Obj *forwardObject(Obj *object);
+void compactHeap();
+void detachViews();
+double gcIdle(double budgetMs);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,352 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "number.h"
+
+#define FORMAT_DIGITS 15
+#define FORMAT_POWER_MAX 27 // long doubles on x86 hold the powers of ten up to here exactly
+#define PARSE_POWER_MAX 22  // and doubles up to here
+
+static const long double powers[FORMAT_POWER_MAX + 1] = {
+    1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L,
+    1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+    1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L,
+};
+
+static const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static size_t formatFallbacks = 0; // for benchNumbers()
+
+// writes the decimal digits of value, returns how many
+static int writeDigits(char *buffer, uint64_t value)
+{
+    char digits[20];
+    char *end = digits + sizeof(digits);
+    char *start = end;
+    while (value >= 100)
+    {
+        start -= 2;
+        memcpy(start, digitPairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+    if (value >= 10)
+    {
+        start -= 2;
+        memcpy(start, digitPairs + value * 2, 2);
+    }
+    else
+    {
+        *--start = (char)('0' + value);
+    }
+    memcpy(buffer, start, end - start);
+    return (int)(end - start);
+}
+
+static int formatFallback(double value, char *buffer)
+{
+    formatFallbacks++;
+    return snprintf(buffer, NUMBER_BUFFER_SIZE, "%.15g", value);
+}
+
+// Integers below 10^15 are written as they are. Anything else is scaled by an
+// exact power of ten into [10^14, 10^15) with a single long double rounding,
+// which leaves the 15 significant digits and the decimal exponent. Only when
+// the scaled value is too close to a rounding tie to tell which way the exact
+// value goes does it fall back to printf, in the spirit of Grisu.
+int formatNumber(double value, char *buffer)
+{
+    if (!isfinite(value))
+    {
+        return formatFallback(value, buffer);
+    }
+    double original = value;
+    char *out = buffer;
+    if (signbit(value))
+    {
+        *out++ = '-';
+        value = -value;
+    }
+    if (value < 1e15 && value == (double)(uint64_t)value)
+    {
+        out += writeDigits(out, (uint64_t)value);
+        return (int)(out - buffer);
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int binaryExponent = (int)(bits >> 52) - 1022; // as frexp() gives it, subnormals fall back below
+    int exponent = ((binaryExponent - 1) * 78913) >> 18; // floor((e - 1) * log10(2)), never too high
+    long double scaled;
+    for (;;)
+    {
+        int shift = FORMAT_DIGITS - 1 - exponent;
+        if (shift > FORMAT_POWER_MAX || shift < -FORMAT_POWER_MAX)
+        {
+            return formatFallback(original, buffer);
+        }
+        scaled = shift >= 0 ? (long double)value * powers[shift] : (long double)value / powers[-shift];
+        if (scaled < 1e14L)
+        {
+            exponent--;
+        }
+        else if (scaled >= 1e15L)
+        {
+            exponent++;
+        }
+        else
+        {
+            break;
+        }
+    }
+    uint64_t whole = (uint64_t)scaled;
+    long double fraction = scaled - (long double)whole;
+    if (fabsl(fraction - 0.5L) <= scaled * LDBL_EPSILON * 2)
+    {
+        return formatFallback(original, buffer);
+    }
+    uint64_t significand = whole + (fraction > 0.5L);
+    if (significand == 1000000000000000ull)
+    {
+        significand /= 10; // rounded up to the next power of ten
+        exponent++;
+    }
+    char digits[FORMAT_DIGITS];
+    writeDigits(digits, significand);
+    int count = FORMAT_DIGITS;
+    while (count > 1 && digits[count - 1] == '0')
+    {
+        count--;
+    }
+
+    if (exponent < -4 || exponent >= FORMAT_DIGITS)
+    {
+        *out++ = digits[0];
+        if (count > 1)
+        {
+            *out++ = '.';
+            memcpy(out, digits + 1, count - 1);
+            out += count - 1;
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        int magnitude = exponent < 0 ? -exponent : exponent;
+        if (magnitude < 10)
+        {
+            *out++ = '0';
+        }
+        out += writeDigits(out, (uint64_t)magnitude);
+    }
+    else if (exponent >= 0)
+    {
+        memcpy(out, digits, exponent + 1);
+        out += exponent + 1;
+        if (count > exponent + 1)
+        {
+            *out++ = '.';
+            memcpy(out, digits + exponent + 1, count - exponent - 1);
+            out += count - exponent - 1;
+        }
+    }
+    else
+    {
+        *out++ = '0';
+        *out++ = '.';
+        memset(out, '0', -exponent - 1);
+        out += -exponent - 1;
+        memcpy(out, digits, count);
+        out += count;
+    }
+    return (int)(out - buffer);
+}
+
+// Literals with at most 19 significant digits whose value and power of ten
+// are both exact doubles take one correctly rounded division (Clinger's fast
+// path). The rest go through strtod().
+double parseNumber(const char *start, int length)
+{
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fractionDigits = 0;
+    bool fraction = false;
+    bool fast = true;
+    for (int i = 0; i < length && fast; i++)
+    {
+        char c = start[i];
+        if (c == '.')
+        {
+            fraction = true;
+        }
+        else if (c >= '0' && c <= '9' && digits < 19)
+        {
+            mantissa = mantissa * 10 + (uint64_t)(c - '0');
+            digits += mantissa != 0;
+            fractionDigits += fraction;
+        }
+        else
+        {
+            fast = false;
+        }
+    }
+    if (fast && mantissa <= ((uint64_t)1 << 53) && fractionDigits <= PARSE_POWER_MAX)
+    {
+        return fractionDigits == 0 ? (double)mantissa : (double)mantissa / (double)powers[fractionDigits];
+    }
+    char text[64];
+    char *copy = length < (int)sizeof(text) ? text : malloc(length + 1);
+    if (copy == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    memcpy(copy, start, length);
+    copy[length] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != text)
+    {
+        free(copy);
+    }
+    return value;
+}
+
+static double benchClockMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static uint64_t benchRandom(uint64_t *state)
+{
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+static double benchSample(int kind, uint64_t *state)
+{
+    uint64_t bits = benchRandom(state);
+    double value;
+    switch (kind)
+    {
+    case 0: // counters and ids
+        return (double)(bits % 10000000);
+    case 1: // prices and other short decimals
+        return (double)(bits % 10000000) / 100.0;
+    case 2: // results of arithmetic
+        return (double)(bits % 100000) * 0.1 / 3.0;
+    default: // any finite double
+        memcpy(&value, &bits, sizeof(value));
+        return isfinite(value) ? value : 1.0;
+    }
+}
+
+// Checks formatNumber() and parseNumber() against the C library on a few
+// kinds of numbers and compares their speed.
+void benchNumbers()
+{
+    static const char *kinds[] = {"integers", "decimals", "arithmetic", "any bits"};
+    int samples = 2000000;
+    double *values = malloc(sizeof(double) * samples);
+    if (values == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n", "numbers", "printf ns", "format ns", "fallback", "strtod ns",
+           "parse ns", "mismatch");
+    for (int kind = 0; kind < 4; kind++)
+    {
+        uint64_t state = 0x9e3779b97f4a7c15ull + kind;
+        for (int i = 0; i < samples; i++)
+        {
+            values[i] = benchSample(kind, &state);
+        }
+        char expected[NUMBER_BUFFER_SIZE];
+        char actual[NUMBER_BUFFER_SIZE];
+        size_t mismatches = 0;
+        size_t sink = 0;
+
+        double startMs = benchClockMs();
+        for (int i = 0; i < samples; i++)
+        {
+            sink += snprintf(expected, sizeof(expected), "%.15g", values[i]);
+        }
+        double printfMs = benchClockMs() - startMs;
+        formatFallbacks = 0;
+        startMs = benchClockMs();
+        for (int i = 0; i < samples; i++)
+        {
+            sink += formatNumber(values[i], actual);
+        }
+        double formatMs = benchClockMs() - startMs;
+        size_t fallbacks = formatFallbacks;
+
+        // literals are never negative or in exponent form, the others are only checked
+        char *literals = malloc((size_t)samples * NUMBER_BUFFER_SIZE);
+        int *lengths = malloc(sizeof(int) * samples);
+        if (literals == NULL || lengths == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+        int literalCount = 0;
+        for (int i = 0; i < samples; i++)
+        {
+            int length = formatNumber(values[i], actual);
+            actual[length] = '\0';
+            snprintf(expected, sizeof(expected), "%.15g", values[i]);
+            if (strcmp(actual, expected) != 0 && mismatches++ < 5)
+            {
+                printf("  %.17g: printf %s, format %s\n", values[i], expected, actual);
+            }
+            if (values[i] >= 0 && strchr(actual, 'e') == NULL)
+            {
+                memcpy(literals + (size_t)literalCount * NUMBER_BUFFER_SIZE, actual, length + 1);
+                lengths[literalCount++] = length;
+            }
+        }
+        double checksum = 0;
+        startMs = benchClockMs();
+        for (int i = 0; i < literalCount; i++)
+        {
+            checksum += strtod(literals + (size_t)i * NUMBER_BUFFER_SIZE, NULL);
+        }
+        double strtodMs = benchClockMs() - startMs;
+        startMs = benchClockMs();
+        for (int i = 0; i < literalCount; i++)
+        {
+            checksum -= parseNumber(literals + (size_t)i * NUMBER_BUFFER_SIZE, lengths[i]);
+        }
+        double parseMs = benchClockMs() - startMs;
+        for (int i = 0; i < literalCount; i++)
+        {
+            const char *literal = literals + (size_t)i * NUMBER_BUFFER_SIZE;
+            double parsed = parseNumber(literal, lengths[i]);
+            double reference = strtod(literal, NULL);
+            if (memcmp(&parsed, &reference, sizeof(double)) != 0 && mismatches++ < 5)
+            {
+                printf("  %s: strtod %.17g, parse %.17g\n", literal, reference, parsed);
+            }
+        }
+        free(literals);
+        free(lengths);
+        sink += checksum != 0;
+        printf("%-12s %10.1f %10.1f %9.2f%% %10.1f %10.1f %10zu\n", kinds[kind], printfMs * 1e6 / samples,
+               formatMs * 1e6 / samples, 100.0 * fallbacks / samples,
+               literalCount > 0 ? strtodMs * 1e6 / literalCount : 0.0,
+               literalCount > 0 ? parseMs * 1e6 / literalCount : 0.0, mismatches);
+        if (sink == 42)
+        {
+            printf("\n"); // keeps the formatting from being optimized away
+        }
+    }
+    free(values);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "common.h"
+
+// Conversions between numbers and their text. formatNumber() writes exactly
+// what printf("%.15g") would, and parseNumber() returns what strtod() would
+// for a number literal, but both take a short exact path for the usual
+// values and only fall back to the C library for the rest. Neither depends on
+// the locale.
+#define NUMBER_BUFFER_SIZE 32 // longest is "-2.22507385850720e-308"
+
+int formatNumber(double value, char *buffer);
+double parseNumber(const char *start, int length);
+void benchNumbers();
+
+#endif
\ No newline at end of file
@@ -5,44 +5,60 @@
 #include "object.h"
 #include "vm.h"
 #include "table.h"
+#include "gcstats.h"
+#include "rc.h"
+#include "gctrace.h"
+#include "hash.h"
+#include "config.h"
 
 #define ALLOCATE_OBJ(type, objectType) \
     (type *)allocateObject(sizeof(type), objectType)
 
 Obj *allocateObject(size_t size, ObjType type)
 {
-    Obj *object = (Obj *)reallocate(NULL, 0, size);
+    Obj *object = allocateSlot(size);
     object->type = type;
-    object->isMarked = false;
-    object->next = vm.objects;
-    vm.objects = object;
+    object->flags = 0;
+    object->selector = 0;
+    object->refCount = 0;
+    if (gcTracing())
+    {
+        gcTraceAlloc(object, heapPageOf(object)->slotSize);
+    }
+    if (rcEnabled())
+    {
+        rcTrack(object);
+    }
+    gcStatsAllocate(type, heapPageOf(object)->slotSize);
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", object, size, type);
 #endif
     return object;
 }
 
-ObjString *allocateString(char *chars, int length, uint32_t hash)
+// a NULL buffer asks for inline characters, the caller fills them in
+static ObjString *allocateString(char *chars, int length, uint32_t hash)
 {
-    ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+    size_t size = sizeof(ObjString) + (chars == NULL ? length + 1 : 0);
+    ObjString *string = (ObjString *)allocateObject(size, OBJ_STRING);
     string->length = length;
-    string->chars = chars;
+    string->chars = chars == NULL ? string->inlineChars : chars;
     string->hash = hash;
-    push(OBJ_VAL(string));
-    tableSet(&vm.strings, string, NIL_VAL);
-    pop();
+    if (chars != NULL)
+    {
+        gcStatsResize(OBJ_STRING, 0, length + 1); // the string takes the buffer over
+    }
+    string->obj.flags = STRING_HASHED;
     return string;
 }
 
-// FNV-1a hash function
-static uint32_t hashString(char *key, int length)
+static ObjString *addInterned(ObjString *string)
 {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++)
-    {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
-    }
+    string->obj.flags |= STRING_INTERNED;
+    push(OBJ_VAL(string));
+    tableSet(&vm.strings, string, NIL_VAL);
+    pop();
+    return string;
 }
 
 ObjString *copyString(char *chars, int length)
@@ -53,10 +69,17 @@ ObjString *copyString(char *chars, int length)
     {
         return interned;
     }
+    if (stringIsInline(length))
+    {
+        ObjString *string = allocateString(NULL, length, hash);
+        memcpy(string->chars, chars, length);
+        string->chars[length] = '\0';
+        return addInterned(string);
+    }
     char *heapChars = ALLOCATE(char, length + 1);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
-    return allocateString(heapChars, length, hash);
+    return addInterned(allocateString(heapChars, length, hash));
 }
 
 ObjString *takeString(char *chars, int length)
@@ -68,17 +91,249 @@ ObjString *takeString(char *chars, int length)
         FREE_ARRAY(char, chars, length + 1);
         return interned;
     }
-    return allocateString(chars, length, hash);
+    if (stringIsInline(length))
+    {
+        ObjString *string = allocateString(NULL, length, hash);
+        memcpy(string->chars, chars, length + 1);
+        FREE_ARRAY(char, chars, length + 1);
+        return addInterned(string);
+    }
+    return addInterned(allocateString(chars, length, hash));
+}
+
+// Strings computed by the running program. They are interned right away
+// unless --lazy-intern is set, in which case internString() or an equality
+// check takes care of it when it matters.
+ObjString *copyRuntimeString(const char *chars, int length)
+{
+    if (!config.lazyIntern)
+    {
+        return copyString((char *)chars, length);
+    }
+    ObjString *string;
+    if (stringIsInline(length))
+    {
+        string = allocateString(NULL, length, 0);
+    }
+    else
+    {
+        string = allocateString(ALLOCATE(char, length + 1), length, 0);
+    }
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    string->obj.flags = 0;
+    return string;
+}
+
+ObjString *takeRuntimeString(char *chars, int length)
+{
+    if (!config.lazyIntern)
+    {
+        return takeString(chars, length);
+    }
+    if (stringIsInline(length))
+    {
+        ObjString *string = copyRuntimeString(chars, length);
+        FREE_ARRAY(char, chars, length + 1);
+        return string;
+    }
+    ObjString *string = allocateString(chars, length, 0);
+    string->obj.flags = 0;
+    return string;
+}
+
+uint32_t stringHash(ObjString *string)
+{
+    if (!(string->obj.flags & STRING_HASHED))
+    {
+        string->hash = hashString(string->chars, string->length);
+        string->obj.flags |= STRING_HASHED;
+    }
+    return string->hash;
+}
+
+// Returns the interned string with the same characters, which is the string
+// itself unless an equal one was interned first. Table keys must be interned.
+ObjString *internString(ObjString *string)
+{
+    string = flattenString(string);
+    if (string->obj.type == OBJ_VIEW)
+    {
+        // table keys own their characters, so the slice is copied
+        return copyString(string->chars, string->length);
+    }
+    if (string->obj.flags & STRING_INTERNED)
+    {
+        return string;
+    }
+    ObjString *interned = tableFindString(&vm.strings, string->chars, string->length, stringHash(string));
+    if (interned != NULL)
+    {
+        return interned;
+    }
+    return addInterned(string);
+}
+
+// Interned strings are equal only when they are the same object, the others
+// are compared by length, hash and then characters. Flattening ropes may
+// allocate, so both strings must be reachable.
+bool stringsEqual(ObjString *a, ObjString *b)
+{
+    if (a == b)
+    {
+        return true;
+    }
+    if (a->length != b->length)
+    {
+        return false;
+    }
+    a = flattenString(a);
+    b = flattenString(b);
+    if (a == b)
+    {
+        return true;
+    }
+    if ((a->obj.flags & STRING_INTERNED) && (b->obj.flags & STRING_INTERNED))
+    {
+        return false;
+    }
+    return stringHash(a) == stringHash(b) && memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+ObjString *newRope(ObjString *left, ObjString *right)
+{
+    ObjRope *rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = left->length + right->length;
+    rope->hash = 0;
+    rope->chars = NULL;
+    rope->left = TO_REF(left);
+    rope->right = TO_REF(right);
+    rope->flat = TO_REF(NULL);
+    return (ObjString *)rope;
+}
+
+// Joins the pieces of a rope into one interned string, which the rope keeps
+// pointing at from then on. Plain strings are returned as they are.
+ObjString *flattenString(ObjString *string)
+{
+    if (string->obj.type != OBJ_ROPE)
+    {
+        return string;
+    }
+    ObjRope *rope = (ObjRope *)string;
+    if (rope->chars != NULL)
+    {
+        return DEREF(ObjString, rope->flat);
+    }
+    push(OBJ_VAL(rope));
+    int length = rope->length;
+    char *chars = ALLOCATE(char, length + 1);
+    chars[length] = '\0';
+
+    // fill the buffer from the end, so the right piece of a node is copied
+    // before its left one. Ropes grown in a loop are left leaning, which
+    // keeps the pending stack short.
+    int capacity = 64;
+    int count = 0;
+    ObjString **pending = (ObjString **)malloc(sizeof(ObjString *) * capacity);
+    if (pending == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    pending[count++] = string;
+    char *end = chars + length;
+    while (count > 0)
+    {
+        ObjString *piece = pending[--count];
+        if (piece->chars != NULL)
+        {
+            end -= piece->length;
+            memcpy(end, piece->chars, piece->length);
+            continue;
+        }
+        if (count + 2 > capacity)
+        {
+            capacity *= 2;
+            pending = (ObjString **)realloc(pending, sizeof(ObjString *) * capacity);
+            if (pending == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(1);
+            }
+        }
+        pending[count++] = DEREF(ObjString, ((ObjRope *)piece)->left);
+        pending[count++] = DEREF(ObjString, ((ObjRope *)piece)->right);
+    }
+    free(pending);
+
+    ObjString *flat = takeRuntimeString(chars, length);
+    // the pieces are no longer needed
+    rcWrite((Obj *)rope, OBJ_VAL(DEREF(ObjString, rope->left)), NIL_VAL);
+    rcWrite((Obj *)rope, OBJ_VAL(DEREF(ObjString, rope->right)), NIL_VAL);
+    rcWrite((Obj *)rope, NIL_VAL, OBJ_VAL(flat));
+    rope->left = TO_REF(NULL);
+    rope->right = TO_REF(NULL);
+    rope->flat = TO_REF(flat);
+    rope->chars = flat->chars;
+    rope->hash = flat->hash; // only meaningful on the flattened string
+    pop();
+    return flat;
+}
+
+static ObjString *newView(ObjString *parent, int offset, int length)
+{
+    ObjView *view = ALLOCATE_OBJ(ObjView, OBJ_VIEW);
+    view->length = length;
+    view->hash = 0;
+    view->chars = parent->chars + offset;
+    view->parent = TO_REF(parent);
+    view->offset = offset;
+    return (ObjString *)view;
+}
+
+// The characters from start to start + length, shared with the string when
+// it has characters that never move. A rope is flattened first, a view is
+// sliced from its own parent so views never chain. Slices that fit in the
+// slot a view would take are copied instead.
+ObjString *substring(ObjString *string, int start, int length)
+{
+    string = flattenString(string);
+    if (start == 0 && length == string->length)
+    {
+        return string;
+    }
+    ObjString *parent = string;
+    int offset = start;
+    if (string->obj.type == OBJ_VIEW && ((ObjView *)string)->parent)
+    {
+        parent = DEREF(ObjString, ((ObjView *)string)->parent);
+        offset += ((ObjView *)string)->offset;
+    }
+    int copyMax = heapSlotSize(sizeof(ObjView)) - (int)sizeof(ObjString) - 1;
+    if (length <= copyMax || (parent->obj.type == OBJ_STRING && stringIsInline(parent->length)))
+    {
+        return copyRuntimeString(string->chars + start, length);
+    }
+    return newView(parent, offset, length);
+}
+
+static void printString(ObjString *string)
+{
+    writeOutput(&vm.output, string->chars, string->length);
 }
 
 static void printFunction(ObjFunction *function)
 {
-    if (function->name == NULL)
+    ObjString *name = DEREF(ObjString, function->name);
+    if (name == NULL)
     {
-        printf("<script>");
+        writeOutput(&vm.output, "<script>", 8);
         return;
     }
-    printf("<fn %s>", function->name->chars);
+    writeOutput(&vm.output, "<fn ", 4);
+    printString(name);
+    writeOutput(&vm.output, ">", 1);
 }
 
 void printObject(Value value)
@@ -86,28 +341,34 @@ void printObject(Value value)
     switch (OBJ_TYPE(value))
     {
     case OBJ_STRING:
-        printf("%s", AS_CSTRING(value));
+    case OBJ_ROPE:
+    case OBJ_VIEW:
+        printString(flattenString(AS_STRING(value))); // views are not NUL terminated
         break;
     case OBJ_NATIVE:
-        printf("<native fn>");
+        writeOutput(&vm.output, "<native fn>", 11);
         break;
     case OBJ_FUNCTION:
         printFunction(AS_FUNCTION(value));
         break;
     case OBJ_CLOSURE:
-        printFunction(AS_CLOSURE(value)->function);
+        printFunction(DEREF(ObjFunction, AS_CLOSURE(value)->function));
         break;
     case OBJ_UPVALUE:
-        printf("upvalue"); // never used...
+        writeOutput(&vm.output, "upvalue", 7); // never used...
         break;
     case OBJ_CLASS:
-        printf("%s", AS_CLASS(value)->name->chars);
+        printString(DEREF(ObjString, AS_CLASS(value)->name));
         break;
     case OBJ_INSTANCE:
-        printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+        {
+        ObjClass *klass = DEREF(ObjClass, AS_INSTANCE(value)->klass);
+        printString(DEREF(ObjString, klass->name));
+        writeOutput(&vm.output, " instance", 9);
+    }
         break;
     case OBJ_BOUND_METHOD:
-        printFunction(AS_BOUND_METHOD(value)->method->function);
+        printFunction(DEREF(ObjFunction, DEREF(ObjClosure, AS_BOUND_METHOD(value)->method)->function));
         break;
     default:
         printf("object type not implemented: %d\n", OBJ_TYPE(value));
@@ -116,10 +377,11 @@ void printObject(Value value)
     }
 }
 
-ObjNative *newNative(NativeFn function)
+ObjNative *newNative(NativeFn function, int arity)
 {
     ObjNative *native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
+    native->arity = arity;
     return native;
 }
 
@@ -127,7 +389,7 @@ ObjFunction *newFunction()
 {
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
-    function->name = NULL;
+    function->name = TO_REF(NULL);
     function->upvalueCount = 0;
     initChunk(&function->chunk);
     return function;
@@ -135,15 +397,22 @@ ObjFunction *newFunction()
 
 ObjClosure *newClosure(ObjFunction *function)
 {
-    ObjUpvalue **upvalues = ALLOCATE(ObjUpvalue *, function->upvalueCount);
-    for (int i = 0; i < function->upvalueCount; i++)
+    int count = function->upvalueCount;
+    REF(ObjUpvalue) *upvalues = NULL;
+    if (!closureIsInline(count))
     {
-        upvalues[i] = NULL;
+        upvalues = ALLOCATE(REF(ObjUpvalue), count);
+        gcStatsResize(OBJ_CLOSURE, 0, sizeof(REF(ObjUpvalue)) * count);
+    }
+    size_t size = sizeof(ObjClosure) + (upvalues == NULL ? count * sizeof(REF(ObjUpvalue)) : 0);
+    ObjClosure *closure = (ObjClosure *)allocateObject(size, OBJ_CLOSURE);
+    closure->function = TO_REF(function);
+    closure->upvalues = upvalues == NULL ? closure->inlineUpvalues : upvalues;
+    closure->upvalueCount = count;
+    for (int i = 0; i < count; i++)
+    {
+        closure->upvalues[i] = TO_REF(NULL);
     }
-    ObjClosure *closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
-    closure->function = function;
-    closure->upvalues = upvalues;
-    closure->upvalueCount = function->upvalueCount;
     return closure;
 }
 
@@ -151,7 +420,7 @@ ObjUpvalue *newUpvalue(Value *slot)
 {
     ObjUpvalue *upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
     upvalue->location = slot;
-    upvalue->next = NULL;
+    upvalue->next = TO_REF(NULL);
     upvalue->closed = NIL_VAL;
     return upvalue;
 }
@@ -159,16 +428,96 @@ ObjUpvalue *newUpvalue(Value *slot)
 ObjClass *newClass(ObjString *name)
 {
     ObjClass *klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
-    klass->name = name;
-    initTable(&klass->methods);
+    klass->name = TO_REF(name);
+    klass->superclass = TO_REF(NULL);
+    klass->vtableBase = 0;
+    klass->vtableSize = 0;
+    klass->vtable = NULL;
+    klass->initializer = TO_REF(NULL);
+    klass->fieldsHint = 0;
     return klass;
 }
 
+// Gives a method name the next selector ID, false when they ran out. The
+// ID stays with the interned string, which the closures of its methods keep
+// alive for as long as a vtable can hold them.
+bool assignSelector(ObjString *name)
+{
+    if (name->obj.selector == 0)
+    {
+        if (vm.selectorCount == SELECTOR_MAX)
+        {
+            return false;
+        }
+        name->obj.selector = ++vm.selectorCount;
+    }
+    return true;
+}
+
+// the closure is expected to be reachable from the stack, growing the vtable may collect
+void defineMethod(ObjClass *klass, ObjString *name, ObjClosure *method)
+{
+    int selector = name->obj.selector;
+    int base = klass->vtableSize == 0 || selector < klass->vtableBase ? selector : klass->vtableBase;
+    int end = klass->vtableSize > 0 && selector < klass->vtableBase + klass->vtableSize
+                  ? klass->vtableBase + klass->vtableSize
+                  : selector + 1;
+    if (base != klass->vtableBase || end - base != klass->vtableSize)
+    {
+        // the old vtable stays in place while allocating, which may collect
+        int size = end - base;
+        REF(ObjClosure) *vtable = ALLOCATE(REF(ObjClosure), size);
+        gcStatsResize(OBJ_CLASS, sizeof(REF(ObjClosure)) * klass->vtableSize, sizeof(REF(ObjClosure)) * size);
+        for (int i = 0; i < size; i++)
+        {
+            vtable[i] = TO_REF(NULL);
+        }
+        if (klass->vtableSize > 0)
+        {
+            memcpy(vtable + (klass->vtableBase - base), klass->vtable, sizeof(REF(ObjClosure)) * klass->vtableSize);
+            FREE_ARRAY(REF(ObjClosure), klass->vtable, klass->vtableSize);
+        }
+        klass->vtable = vtable;
+        klass->vtableBase = base;
+        klass->vtableSize = size;
+    }
+    ObjClosure *previous = DEREF(ObjClosure, klass->vtable[selector - base]);
+    klass->vtable[selector - base] = TO_REF(method);
+    rcWrite((Obj *)klass, previous == NULL ? NIL_VAL : OBJ_VAL(previous), OBJ_VAL(method));
+    if (selector == SELECTOR_INIT)
+    {
+        previous = DEREF(ObjClosure, klass->initializer);
+        klass->initializer = TO_REF(method);
+        rcWrite((Obj *)klass, previous == NULL ? NIL_VAL : OBJ_VAL(previous), OBJ_VAL(method));
+    }
+}
+
+void inheritMethods(ObjClass *subClass, ObjClass *superClass)
+{
+    subClass->superclass = TO_REF(superClass);
+    rcWrite((Obj *)subClass, NIL_VAL, OBJ_VAL(superClass));
+    // runs before the subclass declares any method, its own init replaces this one
+    ObjClosure *initializer = DEREF(ObjClosure, superClass->initializer);
+    if (initializer != NULL)
+    {
+        subClass->initializer = TO_REF(initializer);
+        rcWrite((Obj *)subClass, NIL_VAL, OBJ_VAL(initializer));
+    }
+}
+
 ObjInstance *newInstance(ObjClass *klass)
 {
     ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
-    instance->klass = klass;
+    instance->klass = TO_REF(klass);
     initTable(&instance->fields);
+    instance->fields.statsType = OBJ_INSTANCE;
+    if (klass->fieldsHint > 0)
+    {
+        // sized up front instead of growing while init assigns the fields
+        push(OBJ_VAL(instance));
+        tableReserve(&instance->fields, klass->fieldsHint);
+        pop();
+    }
     return instance;
 }
 
@@ -176,6 +525,6 @@ ObjBoundMethod *newBoundMethod(Value receiver, ObjClosure *method)
 {
     ObjBoundMethod *bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
     bound->receiver = receiver;
-    bound->method = method;
+    bound->method = TO_REF(method);
     return bound;
-}
+}
\ No newline at end of file
@@ -5,10 +5,13 @@
 #include "chunk.h"
 #include "value.h"
 #include "table.h"
+#include "heap.h"
 
 typedef enum
 {
-    OBJ_STRING,
+    OBJ_STRING, // the string types come first, see IS_STRING
+    OBJ_ROPE,
+    OBJ_VIEW,
     OBJ_NATIVE,
     OBJ_FUNCTION,
     OBJ_CLOSURE,
@@ -18,84 +21,175 @@ typedef enum
     OBJ_BOUND_METHOD,
 } ObjType;
 
+// A reference from one object to another. With COMPRESSED_REFS it is stored
+// as a 32 bit heap offset, so reads go through DEREF and writes through
+// TO_REF. Values keep full pointers.
+#ifdef COMPRESSED_REFS
+#define REF(type) uint32_t
+#define DEREF(type, ref) ((type *)heapDecompress(ref))
+#define TO_REF(object) heapCompress(object)
+#else
+#define REF(type) type *
+#define DEREF(type, ref) (ref)
+#define TO_REF(object) (object)
+#endif
+
 struct Obj
 {
-    ObjType type;
-    bool isMarked;
-    struct Obj *next;
+    ObjType type : 8; // mark bits live in the heap page side bitmaps
+    unsigned int flags : 8;
+    unsigned int selector : 16; // of a method name string, 0 for everything else
+    uint32_t refCount; // count and flags for --gc-mode=rc, see rc.h
 };
 
+// Obj.flags of strings. With --lazy-intern, strings computed at run time are
+// neither hashed nor interned until something needs their identity.
+#define STRING_HASHED 0x01
+#define STRING_INTERNED 0x02
+#define STRING_FIELD_NAME 0x04 // some instance got a field of this name
+
+#define SELECTOR_INIT 1 // given to "init" when the VM starts, 0 is any other name
+#define SELECTOR_MAX 0xffff
+#define FIELDS_HINT_MAX 28 // one outsized instance doesn't inflate every later one
+
+// Strings and closures that fit in a heap slot keep their characters and
+// upvalues inline after the header, the pointer then refers to the object
+// itself. Bigger ones fall back to a separate buffer. Whether an object is
+// inline only depends on its length, so it survives being moved.
 struct ObjString
 {
     Obj obj;
     int length;
-    char *chars;
     uint32_t hash;
+    char *chars;
+    char inlineChars[];
 };
 
+// The result of concatenating long strings. It starts with the same fields as
+// ObjString so it can be passed around as one, but chars stays NULL until
+// flattenString() joins the pieces and interns the result.
+typedef struct
+{
+    Obj obj;
+    int length;
+    uint32_t hash;
+    char *chars; // the flattened string's characters, NULL until then
+    REF(ObjString) left;
+    REF(ObjString) right;
+    REF(ObjString) flat;
+} ObjRope;
+
+// A slice of another string made by substring(). It starts like ObjString as
+// well, but chars points into the parent's characters and is not NUL
+// terminated. Only strings whose characters never move are used as parents:
+// long strings and views holding a copy of their own. When a parent is only
+// kept alive for a small slice, the collector has the view copy its
+// characters and drop the parent, which is NULL from then on.
+typedef struct
+{
+    Obj obj;
+    int length;
+    uint32_t hash;
+    char *chars;
+    REF(ObjString) parent;
+    int offset; // of chars in the parent's characters
+} ObjView;
+
+#define VIEW_DETACH_RATIO 4 // views shorter than a quarter of a dead parent copy their slice
+
 typedef Value (*NativeFn)(int argCount, Value *args);
 
 typedef struct
 {
     Obj obj;
     NativeFn function;
+    int arity; // -1 accepts any number of arguments
 } ObjNative;
 
+typedef struct ObjClosure ObjClosure;
+
 typedef struct
 {
     Obj obj;
     int arity;
-    Chunk chunk;
-    ObjString *name;
     int upvalueCount;
+    REF(ObjString) name;
+    Chunk chunk;
 } ObjFunction;
 
 typedef struct ObjUpvalue
 {
     Obj obj;
+    REF(struct ObjUpvalue) next;
     Value *location;
     Value closed;
-    struct ObjUpvalue *next;
 } ObjUpvalue;
 
-typedef struct
+struct ObjClosure
 {
     Obj obj;
-    ObjFunction *function;
-    ObjUpvalue **upvalues;
+    REF(ObjFunction) function;
     int upvalueCount;
-} ObjClosure;
+    REF(ObjUpvalue) *upvalues;
+    REF(ObjUpvalue) inlineUpvalues[];
+};
 
-typedef struct 
+#define STRING_INLINE_MAX ((int)(HEAP_MAX_SMALL_SIZE - sizeof(ObjString) - 1))
+#define CLOSURE_INLINE_MAX ((int)((HEAP_MAX_SMALL_SIZE - sizeof(ObjClosure)) / sizeof(REF(ObjUpvalue))))
+
+static inline bool stringIsInline(int length)
+{
+    return length <= STRING_INLINE_MAX;
+}
+
+static inline bool closureIsInline(int upvalueCount)
+{
+    return upvalueCount <= CLOSURE_INLINE_MAX;
+}
+
+// Every method name gets a selector ID when its first declaration is
+// compiled. A class only keeps the methods it declares itself, in a vtable
+// spanning the lowest to the highest of their selectors, and finds inherited
+// ones through its superclass, so a hierarchy never copies method tables.
+// Lookup is O(depth), not a single index: a range check and an array load
+// for each class walked up to the one declaring the method.
+typedef struct ObjClass
 {
     Obj obj;
-    ObjString *name;
-    Table methods;
+    REF(ObjString) name;
+    REF(struct ObjClass) superclass;
+    int vtableBase; // selector of vtable[0]
+    int vtableSize;
+    REF(ObjClosure) *vtable;
+    REF(ObjClosure) initializer; // init, own or inherited, so constructing never walks the chain
+    int fieldsHint; // most fields an instance got so far up to FIELDS_HINT_MAX, new ones are sized for it
 } ObjClass;
 
 typedef struct
 {
     Obj obj;
-    ObjClass *klass;
+    REF(ObjClass) klass;
     Table fields;
 } ObjInstance;
 
 typedef struct 
 {
     Obj obj;
+    REF(ObjClosure) method;
     Value receiver;
-    ObjClosure *method;
 } ObjBoundMethod;
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
-#define IS_STRING(value) isObjType(value, OBJ_STRING)
+#define IS_STRING(value) (IS_OBJ(value) && AS_OBJ(value)->type <= OBJ_VIEW)
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
+#define IS_VIEW(value) isObjType(value, OBJ_VIEW)
 #define IS_CLOSURE(value) isObjType(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
 #define IS_CLASS(value) isObjType(value, OBJ_CLASS)
 #define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
-#define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define AS_CSTRING(value) (flattenString(AS_STRING(value))->chars) // may allocate, not for views
 #define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value))->function)
 #define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
 #define AS_CLOSURE(value) ((ObjClosure *)AS_OBJ(value))
@@ -110,13 +204,43 @@ static inline bool isObjType(Value value, ObjType type)
 
 ObjString *copyString(char *chars, int length);
 ObjString *takeString(char *chars, int length);
+ObjString *copyRuntimeString(const char *chars, int length);
+ObjString *takeRuntimeString(char *chars, int length);
+ObjString *internString(ObjString *string);
+uint32_t stringHash(ObjString *string);
+bool stringsEqual(ObjString *a, ObjString *b);
+ObjString *newRope(ObjString *left, ObjString *right);
+ObjString *flattenString(ObjString *string);
+ObjString *substring(ObjString *string, int start, int length);
 void printObject(Value value);
-ObjNative *newNative(NativeFn function);
+ObjNative *newNative(NativeFn function, int arity);
 ObjFunction *newFunction();
 ObjClosure *newClosure(ObjFunction *function);
 ObjUpvalue *newUpvalue(Value *slot);
 ObjClass *newClass(ObjString *name);
 ObjInstance *newInstance(ObjClass *klass);
 ObjBoundMethod *newBoundMethod(Value receiver, ObjClosure *method);
+bool assignSelector(ObjString *name);
+void defineMethod(ObjClass *klass, ObjString *name, ObjClosure *method);
+void inheritMethods(ObjClass *subClass, ObjClass *superClass);
+
+static inline ObjClosure *findSelector(ObjClass *klass, unsigned int selector)
+{
+    do
+    {
+        unsigned int slot = selector - (unsigned int)klass->vtableBase; // wraps around below the base
+        if (slot < (unsigned int)klass->vtableSize && klass->vtable[slot])
+        {
+            return DEREF(ObjClosure, klass->vtable[slot]);
+        }
+        klass = DEREF(ObjClass, klass->superclass);
+    } while (klass != NULL);
+    return NULL;
+}
+
+static inline ObjClosure *findMethod(ObjClass *klass, ObjString *name)
+{
+    return findSelector(klass, name->obj.selector);
+}
 
 #endif
\ No newline at end of file
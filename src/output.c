@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#include "output.h"
+
+void initOutput(Output *output, OutputMode mode)
+{
+    output->mode = mode;
+    output->length = 0;
+}
+
+// stdout is unbuffered, so this is a single write
+void flushOutput(Output *output)
+{
+    if (output->length > 0)
+    {
+        fwrite(output->buffer, 1, output->length, stdout);
+        output->length = 0;
+    }
+}
+
+void writeOutput(Output *output, const char *chars, size_t length)
+{
+    if (output->length + length > OUTPUT_BUFFER_SIZE)
+    {
+        flushOutput(output);
+        if (length > OUTPUT_BUFFER_SIZE)
+        {
+            fwrite(chars, 1, length, stdout);
+            return;
+        }
+    }
+    memcpy(output->buffer + output->length, chars, length);
+    output->length += length;
+}
+
+void endOutputLine(Output *output)
+{
+    writeOutput(output, "\n", 1);
+    if (output->mode == OUTPUT_LINE)
+    {
+        flushOutput(output);
+    }
+}
\ No newline at end of file
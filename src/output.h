@@ -0,0 +1,25 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include "common.h"
+#include "config.h"
+
+// What the program prints is collected in a buffer owned by the VM and
+// written to stdout in one go: after every line in line mode, otherwise when
+// the buffer is full. Either way it is flushed when a script ends, before a
+// runtime error is reported and when the program calls flush().
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef struct
+{
+    OutputMode mode;
+    size_t length;
+    char buffer[OUTPUT_BUFFER_SIZE];
+} Output;
+
+void initOutput(Output *output, OutputMode mode);
+void writeOutput(Output *output, const char *chars, size_t length);
+void endOutputLine(Output *output);
+void flushOutput(Output *output);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pacer.h"
+#include "config.h"
+#include "gcstats.h"
+#include "vm.h"
+
+#define PACER_MAX_GROWTH_SCALE 4.0
+#define PACER_LIMIT_FRACTION 0.9 // the rest of the limit is left for everything but the heap
+#define PACER_MAJOR_FRACTION 0.75
+
+Pacer pacer;
+
+void initPacer()
+{
+    pacer.growth = config.gcGrowthFactor;
+    pacer.gcCpu = 0;
+    pacer.lastEndMs = gcClockMs();
+    pacer.sweepMs = 0;
+    pacer.memoryLimit = config.gcMemoryLimit;
+    if (pacer.memoryLimit == 0 && config.gcCgroupFile != NULL)
+    {
+        pacer.memoryLimit = readCgroupLimit(config.gcCgroupFile);
+    }
+}
+
+// cgroup v2 memory.max holds either a byte count or "max"
+size_t readCgroupLimit(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    char buffer[64];
+    size_t limit = 0;
+    if (fgets(buffer, sizeof(buffer), file) != NULL && strncmp(buffer, "max", 3) != 0)
+    {
+        limit = (size_t)strtoull(buffer, NULL, 10);
+    }
+    fclose(file);
+    return limit;
+}
+
+static double heapCeiling()
+{
+    return pacer.memoryLimit * PACER_LIMIT_FRACTION;
+}
+
+// Close to the limit every collection sweeps eagerly and returns free pages to
+// the OS. Checked after marking: either the live data alone takes half of the
+// room or the heap reached the trigger well into the limit.
+bool pacerNearLimit()
+{
+    if (pacer.memoryLimit == 0)
+    {
+        return false;
+    }
+    double ceiling = heapCeiling();
+    return vm.bytesMarked > ceiling / 2 || vm.bytesAllocated > ceiling * PACER_MAJOR_FRACTION;
+}
+
+size_t pacerNextGC(double startMs, double endMs)
+{
+    double gcMs = endMs - startMs + pacer.sweepMs;
+    double elapsedMs = endMs - pacer.lastEndMs;
+    pacer.gcCpu = elapsedMs > 0 ? gcMs / elapsedMs : 0;
+    pacer.lastEndMs = endMs;
+    pacer.sweepMs = 0;
+
+    // spend more memory when the collector is too busy, give it back when it is idle
+    double target = config.gcTargetCpu / 100.0;
+    if (pacer.gcCpu > target)
+    {
+        pacer.growth *= 1.5;
+        double limit = config.gcGrowthFactor * PACER_MAX_GROWTH_SCALE;
+        if (pacer.growth > limit)
+        {
+            pacer.growth = limit;
+        }
+    }
+    else if (pacer.gcCpu < target / 2)
+    {
+        pacer.growth /= 1.2;
+        if (pacer.growth < config.gcGrowthFactor)
+        {
+            pacer.growth = config.gcGrowthFactor;
+        }
+    }
+
+    size_t live = vm.bytesMarked;
+    double goal = live * pacer.growth;
+    if (goal < config.gcMinHeap)
+    {
+        goal = config.gcMinHeap;
+    }
+    if (config.gcMaxHeap > 0 && goal > config.gcMaxHeap)
+    {
+        // over the limit the heap still needs some room to make progress
+        goal = config.gcMaxHeap > live + live / 8 ? config.gcMaxHeap : live + live / 8;
+    }
+    if (pacer.memoryLimit > 0)
+    {
+        // let the heap grow by half of the room left, so collections get closer together near the limit
+        double ceiling = heapCeiling();
+        if (live + live / 16 >= ceiling)
+        {
+            goal = live + live / 16;
+        }
+        else if (goal > live + (ceiling - live) / 2)
+        {
+            goal = live + (ceiling - live) / 2;
+        }
+    }
+    // unswept garbage is still counted, lazy sweeping lowers the trigger as it frees it
+    return vm.bytesAllocated + (size_t)goal - live;
+}
@@ -0,0 +1,25 @@
+#ifndef clox_pacer_h
+#define clox_pacer_h
+
+#include "common.h"
+
+// Decides where the next collection triggers. The growth factor starts at
+// the configured value and is adapted after every collection so the time
+// spent marking and sweeping stays close to the configured CPU target.
+typedef struct
+{
+    double growth;
+    double gcCpu;     // fraction of the last GC interval spent in the collector
+    double lastEndMs; // end of the previous collection
+    double sweepMs;   // lazy sweep time accumulated since the previous collection
+    size_t memoryLimit; // 0 when the process is not limited
+} Pacer;
+
+extern Pacer pacer;
+
+void initPacer();
+size_t readCgroupLimit(const char *path);
+bool pacerNearLimit();
+size_t pacerNextGC(double startMs, double endMs);
+
+#endif
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rc.h"
+#include "memory.h"
+#include "compiler.h"
+#include "freer.h"
+#include "gctrace.h"
+#include "vm.h"
+
+RefCounts rc;
+
+void initRefCounts()
+{
+    rc.zct = NULL;
+    rc.zctCount = 0;
+    rc.zctCapacity = 0;
+    rc.bytesAtReconcile = 0;
+    rc.reconciles = 0;
+    rc.freed = 0;
+}
+
+void freeRefCounts()
+{
+    free(rc.zct);
+    initRefCounts();
+}
+
+static void pushZct(Obj *object)
+{
+    if (rc.zctCapacity < rc.zctCount + 1)
+    {
+        rc.zctCapacity = rc.zctCapacity < 64 ? 64 : rc.zctCapacity * 2;
+        // not using reallocate() here, the table is collector bookkeeping
+        rc.zct = (Obj **)realloc(rc.zct, sizeof(Obj *) * rc.zctCapacity);
+        if (rc.zct == NULL)
+        {
+            exit(1);
+        }
+    }
+    object->refCount |= RC_IN_ZCT;
+    rc.zct[rc.zctCount++] = object;
+}
+
+void rcTrack(Obj *object)
+{
+    object->refCount = RC_NEW;
+    pushZct(object);
+}
+
+static void increment(Obj *object)
+{
+    if ((object->refCount & RC_COUNT) != RC_COUNT)
+    {
+        object->refCount++;
+    }
+}
+
+// never frees on the spot: the object may still be on the stack, which is
+// only known when the ZCT is reconciled
+static void decrement(Obj *object)
+{
+    uint32_t count = object->refCount & RC_COUNT;
+    if (count == 0 || count == RC_COUNT)
+    {
+        return;
+    }
+    object->refCount--;
+    if (count == 1 && !(object->refCount & RC_IN_ZCT))
+    {
+        pushZct(object);
+    }
+}
+
+static inline void visitValue(Value value, void (*visit)(Obj *object))
+{
+    if (IS_OBJ(value))
+    {
+        visit(AS_OBJ(value));
+    }
+}
+
+static void visitTable(Table *table, void (*visit)(Obj *object))
+{
+    for (int i = 0; i < tableSlots(table); i++)
+    {
+        Entry *entry = tableSlot(table, i);
+        if (entry->key != NULL)
+        {
+            visit((Obj *)entry->key);
+            visitValue(entry->value, visit);
+        }
+    }
+}
+
+// same edges as blackenObject()
+static void visitReferences(Obj *object, void (*visit)(Obj *object))
+{
+    switch (object->type)
+    {
+    case OBJ_UPVALUE:
+        visitValue(((ObjUpvalue *)object)->closed, visit);
+        break;
+    case OBJ_FUNCTION:
+    {
+        ObjFunction *function = (ObjFunction *)object;
+        if (function->name)
+        {
+            visit((Obj *)DEREF(ObjString, function->name));
+        }
+        for (int i = 0; i < function->chunk.constants.count; i++)
+        {
+            visitValue(function->chunk.constants.values[i], visit);
+        }
+        break;
+    }
+    case OBJ_CLOSURE:
+    {
+        ObjClosure *closure = (ObjClosure *)object;
+        visit((Obj *)DEREF(ObjFunction, closure->function));
+        for (int i = 0; i < closure->upvalueCount; i++)
+        {
+            if (closure->upvalues[i])
+            {
+                visit((Obj *)DEREF(ObjUpvalue, closure->upvalues[i]));
+            }
+        }
+        break;
+    }
+    case OBJ_CLASS:
+    {
+        ObjClass *klass = (ObjClass *)object;
+        visit((Obj *)DEREF(ObjString, klass->name));
+        if (klass->superclass)
+        {
+            visit((Obj *)DEREF(ObjClass, klass->superclass));
+        }
+        if (klass->initializer)
+        {
+            visit((Obj *)DEREF(ObjClosure, klass->initializer));
+        }
+        for (int i = 0; i < klass->vtableSize; i++)
+        {
+            if (klass->vtable[i])
+            {
+                visit((Obj *)DEREF(ObjClosure, klass->vtable[i]));
+            }
+        }
+        break;
+    }
+    case OBJ_INSTANCE:
+    {
+        ObjInstance *instance = (ObjInstance *)object;
+        visit((Obj *)DEREF(ObjClass, instance->klass));
+        visitTable(&instance->fields, visit);
+        break;
+    }
+    case OBJ_BOUND_METHOD:
+    {
+        ObjBoundMethod *bound = (ObjBoundMethod *)object;
+        visitValue(bound->receiver, visit);
+        visit((Obj *)DEREF(ObjClosure, bound->method));
+        break;
+    }
+    case OBJ_ROPE:
+    {
+        ObjRope *rope = (ObjRope *)object;
+        if (rope->left)
+        {
+            visit((Obj *)DEREF(ObjString, rope->left));
+            visit((Obj *)DEREF(ObjString, rope->right));
+        }
+        if (rope->flat)
+        {
+            visit((Obj *)DEREF(ObjString, rope->flat));
+        }
+        break;
+    }
+    case OBJ_VIEW:
+    {
+        ObjView *view = (ObjView *)object;
+        if (view->parent)
+        {
+            visit((Obj *)DEREF(ObjString, view->parent));
+        }
+        break;
+    }
+    case OBJ_NATIVE:
+    case OBJ_STRING:
+        break;
+    }
+}
+
+static inline bool counted(Obj *owner)
+{
+    return rcEnabled() && !(owner->refCount & RC_NEW);
+}
+
+// the barriers double as the store hook of the allocation trace
+void rcWrite(Obj *owner, Value oldValue, Value newValue)
+{
+    if (gcTracing())
+    {
+        gcTraceStore(owner, newValue);
+    }
+    if (!counted(owner))
+    {
+        return;
+    }
+    visitValue(newValue, increment);
+    visitValue(oldValue, decrement);
+}
+
+bool rcTableSet(Obj *owner, Table *table, ObjString *key, Value value)
+{
+    if (gcTracing())
+    {
+        gcTraceStore(owner, value);
+    }
+    if (!counted(owner))
+    {
+        return tableSet(table, key, value);
+    }
+    Value oldValue = NIL_VAL;
+    tableGet(table, key, &oldValue);
+    bool isNewKey = tableSet(table, key, value);
+    if (isNewKey)
+    {
+        increment((Obj *)key);
+    }
+    visitValue(value, increment);
+    visitValue(oldValue, decrement);
+    return isNewKey;
+}
+
+static void setRoot(Obj *object)
+{
+    object->refCount |= RC_ROOT;
+}
+
+static void clearRoot(Obj *object)
+{
+    object->refCount &= ~RC_ROOT;
+}
+
+// the roots of markRoots(), minus the compiler (reconciling waits for it)
+static void visitRoots(void (*visit)(Obj *object))
+{
+    for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+    {
+        visitValue(*slot, visit);
+    }
+    for (int i = 0; i < vm.frameCount; i++)
+    {
+        visit((Obj *)vm.frames[i].closure);
+    }
+    for (ObjUpvalue *upvalue = vm.openUpvalues; upvalue != NULL; upvalue = DEREF(ObjUpvalue, upvalue->next))
+    {
+        visit((Obj *)upvalue);
+    }
+    visitTable(&vm.globals, visit);
+    if (vm.initString != NULL)
+    {
+        visit((Obj *)vm.initString);
+    }
+}
+
+static void release(Obj *object)
+{
+    visitReferences(object, decrement);
+    if (object->type == OBJ_STRING && (object->flags & STRING_INTERNED))
+    {
+        tableDelete(&vm.strings, (ObjString *)object); // interning is a weak reference
+    }
+    rc.freed++;
+    if (gcTracing())
+    {
+        gcTraceFree(object, true);
+    }
+    heapFreeSlot(&vm.heap, object);
+}
+
+void rcReconcile()
+{
+    if (isCompiling())
+    {
+        // the compiler fills in functions without barriers, let it finish first
+        return;
+    }
+    rc.reconciles++;
+    // objects that made it this far get their own references counted
+    for (int i = 0; i < rc.zctCount; i++)
+    {
+        Obj *object = rc.zct[i];
+        if (object->refCount & RC_NEW)
+        {
+            object->refCount &= ~RC_NEW;
+            visitReferences(object, increment);
+        }
+    }
+    visitRoots(setRoot);
+    // releasing an object may queue more entries, they are handled in the same pass
+    int kept = 0;
+    for (int i = 0; i < rc.zctCount; i++)
+    {
+        Obj *object = rc.zct[i];
+        if ((object->refCount & RC_COUNT) != 0)
+        {
+            object->refCount &= ~RC_IN_ZCT;
+        }
+        else if (object->refCount & RC_ROOT)
+        {
+            rc.zct[kept++] = object; // still only on the stack, check again next time
+        }
+        else
+        {
+            release(object);
+        }
+    }
+    rc.zctCount = kept;
+    rc.bytesAtReconcile = vm.bytesAllocated;
+    visitRoots(clearRoot);
+    freerFlush();
+}
+
+static void decrementMarked(Obj *object)
+{
+    if (heapIsMarked(object))
+    {
+        decrement(object);
+    }
+}
+
+static void dropDeadReferences(Obj *object)
+{
+    // references held by garbage found by the trace would keep live objects counted forever
+    if (!heapIsMarked(object) && !(object->refCount & RC_NEW))
+    {
+        visitReferences(object, decrementMarked);
+    }
+}
+
+// called by the tracing collector between marking and sweeping
+void rcAfterMark()
+{
+    int kept = 0;
+    for (int i = 0; i < rc.zctCount; i++)
+    {
+        if (heapIsMarked(rc.zct[i]))
+        {
+            rc.zct[kept++] = rc.zct[i];
+        }
+    }
+    rc.zctCount = kept;
+    heapVisitObjects(&vm.heap, dropDeadReferences);
+}
\ No newline at end of file
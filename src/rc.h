@@ -0,0 +1,49 @@
+#ifndef clox_rc_h
+#define clox_rc_h
+
+#include "common.h"
+#include "object.h"
+#include "config.h"
+
+// Deferred reference counting (--gc-mode=rc). Only references stored in the
+// heap are counted, the stack and globals are roots that are scanned when the
+// zero count table (ZCT) is reconciled. Objects start out "new": their own
+// references are counted once, when they first survive a reconciliation, so
+// stores into a new object need no barrier. The tracing collector still runs
+// as the cycle collector.
+#define RC_NEW 0x80000000u    // outgoing references not counted yet
+#define RC_IN_ZCT 0x40000000u // queued on the zero count table
+#define RC_ROOT 0x20000000u   // directly referenced by a root, only set while reconciling
+#define RC_COUNT 0x1fffffffu  // saturates, a stuck count is left to the tracer
+
+// reconcile after this many new zero count entries or this much allocation,
+// whichever comes first
+#define RC_ZCT_LIMIT 4096
+#define RC_BYTES_LIMIT (1024 * 1024)
+
+typedef struct
+{
+    Obj **zct;
+    int zctCount;
+    int zctCapacity;
+    size_t bytesAtReconcile; // vm.bytesAllocated after the last reconciliation
+    size_t reconciles;
+    size_t freed; // objects reclaimed without a trace
+} RefCounts;
+
+extern RefCounts rc;
+
+static inline bool rcEnabled()
+{
+    return config.gcMode == GC_MODE_RC;
+}
+
+void initRefCounts();
+void freeRefCounts();
+void rcTrack(Obj *object);
+void rcWrite(Obj *owner, Value oldValue, Value newValue);
+bool rcTableSet(Obj *owner, Table *table, ObjString *key, Value value);
+void rcReconcile();
+void rcAfterMark();
+
+#endif
\ No newline at end of file
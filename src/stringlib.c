@@ -0,0 +1,561 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stringlib.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "vm.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define STRING_SIMD
+#endif
+
+// Scanning kernels. The vector versions look for the first and the last byte
+// of the needle at once, a block at a time, and only compare the rest of the
+// needle where both match. Case conversion flips the 0x20 bit of the bytes
+// within 26 of 'a' (or 'A'), which leaves anything that isn't ASCII alone.
+typedef int (*FindFn)(const char *text, int length, const char *needle, int needleLength);
+typedef void (*CaseFn)(char *dest, const char *src, int length, char from);
+
+static int findScalar(const char *text, int length, const char *needle, int needleLength);
+static void caseScalar(char *dest, const char *src, int length, char from);
+
+static FindFn find = findScalar;
+static CaseFn convertCase = caseScalar;
+
+static int findScalar(const char *text, int length, const char *needle, int needleLength)
+{
+    if (needleLength == 0)
+    {
+        return 0;
+    }
+    if (needleLength > length)
+    {
+        return -1;
+    }
+    const char *last = text + length - needleLength; // last place a match can start
+    const char *candidate = text;
+    while (candidate <= last)
+    {
+        candidate = memchr(candidate, needle[0], last - candidate + 1);
+        if (candidate == NULL)
+        {
+            return -1;
+        }
+        if (memcmp(candidate + 1, needle + 1, needleLength - 1) == 0)
+        {
+            return (int)(candidate - text);
+        }
+        candidate++;
+    }
+    return -1;
+}
+
+static void caseScalar(char *dest, const char *src, int length, char from)
+{
+    for (int i = 0; i < length; i++)
+    {
+        uint8_t c = (uint8_t)src[i];
+        dest[i] = (char)((uint8_t)(c - from) < 26 ? c ^ 0x20 : c);
+    }
+}
+
+#ifdef STRING_SIMD
+static int findSse2(const char *text, int length, const char *needle, int needleLength)
+{
+    if (needleLength < 2)
+    {
+        return findScalar(text, length, needle, needleLength); // memchr is vectorized already
+    }
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+    int i = 0;
+    for (; i + needleLength + 15 <= length; i += 16)
+    {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i *)(text + i + needleLength - 1));
+        __m128i both = _mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(both);
+        while (mask != 0)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(text + i + bit + 1, needle + 1, needleLength - 2) == 0)
+            {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    int rest = findScalar(text + i, length - i, needle, needleLength);
+    return rest < 0 ? -1 : i + rest;
+}
+
+__attribute__((target("avx2"))) static int findAvx2(const char *text, int length, const char *needle,
+                                                    int needleLength)
+{
+    if (needleLength < 2)
+    {
+        return findScalar(text, length, needle, needleLength);
+    }
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+    int i = 0;
+    for (; i + needleLength + 31 <= length; i += 32)
+    {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i *)(text + i + needleLength - 1));
+        __m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, last));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(both);
+        while (mask != 0)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(text + i + bit + 1, needle + 1, needleLength - 2) == 0)
+            {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    int rest = findSse2(text + i, length - i, needle, needleLength);
+    return rest < 0 ? -1 : i + rest;
+}
+
+static void caseSse2(char *dest, const char *src, int length, char from)
+{
+    __m128i base = _mm_set1_epi8(from);
+    __m128i span = _mm_set1_epi8(25);
+    __m128i flip = _mm_set1_epi8(0x20);
+    int i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i offset = _mm_sub_epi8(chars, base);
+        __m128i letters = _mm_cmpeq_epi8(_mm_min_epu8(offset, span), offset); // offset <= 25, unsigned
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_xor_si128(chars, _mm_and_si128(letters, flip)));
+    }
+    caseScalar(dest + i, src + i, length - i, from);
+}
+
+__attribute__((target("avx2"))) static void caseAvx2(char *dest, const char *src, int length, char from)
+{
+    __m256i base = _mm256_set1_epi8(from);
+    __m256i span = _mm256_set1_epi8(25);
+    __m256i flip = _mm256_set1_epi8(0x20);
+    int i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i offset = _mm256_sub_epi8(chars, base);
+        __m256i letters = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, span), offset);
+        _mm256_storeu_si256((__m256i *)(dest + i), _mm256_xor_si256(chars, _mm256_and_si256(letters, flip)));
+    }
+    caseSse2(dest + i, src + i, length - i, from);
+}
+#endif
+
+void initStringLib()
+{
+#ifdef STRING_SIMD
+    // SSE2 is part of x86-64, AVX2 has to be asked for
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    find = avx2 ? findAvx2 : findSse2;
+    convertCase = avx2 ? caseAvx2 : caseSse2;
+#endif
+}
+
+const char *stringLibImplementation()
+{
+#ifdef STRING_SIMD
+    if (find == findAvx2)
+    {
+        return "avx2";
+    }
+    if (find == findSse2)
+    {
+        return "sse2";
+    }
+#endif
+    return "scalar";
+}
+
+// flattens ropes so the characters can be scanned, NULL if it isn't a string
+static ObjString *stringArg(Value value)
+{
+    return IS_STRING(value) ? flattenString(AS_STRING(value)) : NULL;
+}
+
+static bool isIndex(Value value, int length)
+{
+    if (!IS_NUMBER(value))
+    {
+        return false;
+    }
+    double index = AS_NUMBER(value);
+    return index >= 0 && index <= length && index == (int)index;
+}
+
+static int countMatches(ObjString *string, ObjString *needle)
+{
+    int count = 0;
+    int start = 0;
+    for (;;)
+    {
+        int found = find(string->chars + start, string->length - start, needle->chars, needle->length);
+        if (found < 0)
+        {
+            return count;
+        }
+        count++;
+        start += found + needle->length;
+    }
+}
+
+static bool isWhitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static Value mapCase(Value value, char from)
+{
+    ObjString *string = stringArg(value);
+    if (string == NULL)
+    {
+        return nativeError("Argument must be a string.");
+    }
+    char *chars = ALLOCATE(char, string->length + 1);
+    convertCase(chars, string->chars, string->length, from);
+    chars[string->length] = '\0';
+    return OBJ_VAL(takeRuntimeString(chars, string->length));
+}
+
+// substring(string, start, end) returns the characters from start up to but
+// not including end. Long slices share the characters of the string.
+Value substringNative(int argCount, Value *args)
+{
+    if (!IS_STRING(args[0]))
+    {
+        return nativeError("Substring source must be a string.");
+    }
+    if (!IS_NUMBER(args[1]) || !IS_NUMBER(args[2]))
+    {
+        return nativeError("Substring bounds must be numbers.");
+    }
+    ObjString *string = AS_STRING(args[0]);
+    double start = AS_NUMBER(args[1]);
+    double end = AS_NUMBER(args[2]);
+    if (!(start >= 0 && start <= end && end <= string->length))
+    {
+        return nativeError("Substring bounds out of range.");
+    }
+    if (start != (int)start || end != (int)end)
+    {
+        return nativeError("Substring bounds must be integers.");
+    }
+    return OBJ_VAL(substring(string, (int)start, (int)end - (int)start));
+}
+
+Value lengthNative(int argCount, Value *args)
+{
+    if (!IS_STRING(args[0]))
+    {
+        return nativeError("Argument must be a string.");
+    }
+    return NUMBER_VAL(AS_STRING(args[0])->length);
+}
+
+// indexOf(string, needle) or indexOf(string, needle, start), -1 if not found
+Value indexOfNative(int argCount, Value *args)
+{
+    if (argCount != 2 && argCount != 3)
+    {
+        return nativeError("Expected 2 or 3 arguments.");
+    }
+    ObjString *string = stringArg(args[0]);
+    ObjString *needle = stringArg(args[1]);
+    if (string == NULL || needle == NULL)
+    {
+        return nativeError("Arguments must be strings.");
+    }
+    int start = 0;
+    if (argCount == 3)
+    {
+        if (!isIndex(args[2], string->length))
+        {
+            return nativeError("Search start must be an integer index into the string.");
+        }
+        start = (int)AS_NUMBER(args[2]);
+    }
+    int found = find(string->chars + start, string->length - start, needle->chars, needle->length);
+    return NUMBER_VAL(found < 0 ? -1 : start + found);
+}
+
+Value containsNative(int argCount, Value *args)
+{
+    ObjString *string = stringArg(args[0]);
+    ObjString *needle = stringArg(args[1]);
+    if (string == NULL || needle == NULL)
+    {
+        return nativeError("Arguments must be strings.");
+    }
+    return BOOL_VAL(find(string->chars, string->length, needle->chars, needle->length) >= 0);
+}
+
+// non-overlapping occurrences of needle
+Value countNative(int argCount, Value *args)
+{
+    ObjString *string = stringArg(args[0]);
+    ObjString *needle = stringArg(args[1]);
+    if (string == NULL || needle == NULL)
+    {
+        return nativeError("Arguments must be strings.");
+    }
+    if (needle->length == 0)
+    {
+        return nativeError("Pattern must not be empty.");
+    }
+    return NUMBER_VAL(countMatches(string, needle));
+}
+
+// Lox has no lists, so split(string, separator, n) returns the field number n
+// (from 0), or nil past the last one. There are count(string, separator) + 1
+// fields. Fields are substrings, so long ones share the characters.
+Value splitNative(int argCount, Value *args)
+{
+    ObjString *string = stringArg(args[0]);
+    ObjString *separator = stringArg(args[1]);
+    if (string == NULL || separator == NULL)
+    {
+        return nativeError("Arguments must be strings.");
+    }
+    if (separator->length == 0)
+    {
+        return nativeError("Separator must not be empty.");
+    }
+    if (!isIndex(args[2], INT_MAX)) // range first, converting NaN or 1e10 to int is undefined
+    {
+        return nativeError("Field index must be a non-negative integer.");
+    }
+    int start = 0;
+    for (int field = (int)AS_NUMBER(args[2]); field > 0; field--)
+    {
+        int found = find(string->chars + start, string->length - start, separator->chars, separator->length);
+        if (found < 0)
+        {
+            return NIL_VAL;
+        }
+        start += found + separator->length;
+    }
+    int end = find(string->chars + start, string->length - start, separator->chars, separator->length);
+    return OBJ_VAL(substring(string, start, end < 0 ? string->length - start : end));
+}
+
+// replace(string, pattern, replacement) replaces every occurrence
+Value replaceNative(int argCount, Value *args)
+{
+    ObjString *string = stringArg(args[0]);
+    ObjString *pattern = stringArg(args[1]);
+    ObjString *replacement = stringArg(args[2]);
+    if (string == NULL || pattern == NULL || replacement == NULL)
+    {
+        return nativeError("Arguments must be strings.");
+    }
+    if (pattern->length == 0)
+    {
+        return nativeError("Pattern must not be empty.");
+    }
+    int matches = countMatches(string, pattern);
+    if (matches == 0)
+    {
+        return OBJ_VAL(string);
+    }
+    int64_t total = string->length + (int64_t)matches * (replacement->length - pattern->length);
+    if (total > INT32_MAX - 1)
+    {
+        return nativeError("Replaced string is too long.");
+    }
+    int length = (int)total;
+    char *chars = ALLOCATE(char, length + 1);
+    char *dest = chars;
+    int start = 0;
+    for (int i = 0; i < matches; i++)
+    {
+        int found = find(string->chars + start, string->length - start, pattern->chars, pattern->length);
+        memcpy(dest, string->chars + start, found);
+        dest += found;
+        memcpy(dest, replacement->chars, replacement->length);
+        dest += replacement->length;
+        start += found + pattern->length;
+    }
+    memcpy(dest, string->chars + start, string->length - start);
+    chars[length] = '\0';
+    return OBJ_VAL(takeRuntimeString(chars, length));
+}
+
+// strips ASCII whitespace from both ends
+Value trimNative(int argCount, Value *args)
+{
+    ObjString *string = stringArg(args[0]);
+    if (string == NULL)
+    {
+        return nativeError("Argument must be a string.");
+    }
+    int start = 0;
+    int end = string->length;
+    while (start < end && isWhitespace(string->chars[start]))
+    {
+        start++;
+    }
+    while (end > start && isWhitespace(string->chars[end - 1]))
+    {
+        end--;
+    }
+    return OBJ_VAL(substring(string, start, end - start));
+}
+
+// formats a number the way print does
+Value toStringNative(int argCount, Value *args)
+{
+    if (!IS_NUMBER(args[0]))
+    {
+        return nativeError("Argument must be a number.");
+    }
+    char buffer[NUMBER_BUFFER_SIZE];
+    int length = formatNumber(AS_NUMBER(args[0]), buffer);
+    return OBJ_VAL(copyRuntimeString(buffer, length));
+}
+
+Value upperNative(int argCount, Value *args)
+{
+    return mapCase(args[0], 'a');
+}
+
+Value lowerNative(int argCount, Value *args)
+{
+    return mapCase(args[0], 'A');
+}
+
+static double benchClockMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static double benchFind(FindFn kernel, const char *text, int length, const char *needle, int *sink)
+{
+    int rounds = 200;
+    double startMs = benchClockMs();
+    for (int i = 0; i < rounds; i++)
+    {
+        *sink += kernel(text, length, needle, (int)strlen(needle));
+    }
+    double elapsedMs = benchClockMs() - startMs;
+    return (double)rounds * length / (1024.0 * 1024.0) / (elapsedMs / 1000.0);
+}
+
+static double benchCase(CaseFn kernel, char *dest, const char *text, int length)
+{
+    int rounds = 200;
+    double startMs = benchClockMs();
+    for (int i = 0; i < rounds; i++)
+    {
+        kernel(dest, text, length, 'a');
+    }
+    double elapsedMs = benchClockMs() - startMs;
+    return (double)rounds * length / (1024.0 * 1024.0) / (elapsedMs / 1000.0);
+}
+
+// every needle at every offset of a short text has to give the scalar answer
+static bool kernelsAgree(FindFn findKernel, CaseFn caseKernel)
+{
+    char text[300];
+    char upper[300];
+    char expected[300];
+    for (int i = 0; i < 300; i++)
+    {
+        text[i] = "abcab cAB,z{`@"[(i * 7 + i / 13) % 14];
+    }
+    for (int start = 0; start < 64; start++)
+    {
+        for (int needleLength = 0; needleLength < 40; needleLength++)
+        {
+            for (int at = 0; at + needleLength <= 300; at += 17)
+            {
+                const char *needle = text + at;
+                int length = 300 - start;
+                if (findKernel(text + start, length, needle, needleLength) !=
+                    findScalar(text + start, length, needle, needleLength))
+                {
+                    return false;
+                }
+            }
+        }
+        caseKernel(upper, text + start, 300 - start, 'a');
+        caseScalar(expected, text + start, 300 - start, 'a');
+        if (memcmp(upper, expected, 300 - start) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compares the kernels on a 1MB text where the needle only shows up at the end.
+void benchStrings()
+{
+    int length = 1024 * 1024;
+    char *text = malloc(length + 1);
+    char *dest = malloc(length);
+    if (text == NULL || dest == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    for (int i = 0; i < length; i++)
+    {
+        text[i] = i % 8 == 7 ? ' ' : (char)('a' + (i * 7) % 26);
+    }
+    const char *needle = "needle=1;";
+    memcpy(text + length - strlen(needle), needle, strlen(needle));
+    text[length] = '\0';
+    struct
+    {
+        const char *name;
+        FindFn find;
+        CaseFn convertCase;
+    } kernels[] = {
+        {"scalar", findScalar, caseScalar},
+#ifdef STRING_SIMD
+        {"sse2", findSse2, caseSse2},
+        {"avx2", findAvx2, caseAvx2},
+#endif
+    };
+    int sink = 0;
+    printf("string kernels selected: %s\n", stringLibImplementation());
+    printf("%8s %12s %12s %12s %8s\n", "kernel", "find MB/s", "find1 MB/s", "upper MB/s", "agree");
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+#ifdef STRING_SIMD
+        if (kernels[i].find == findAvx2 && !__builtin_cpu_supports("avx2"))
+        {
+            continue;
+        }
+#endif
+        printf("%8s %12.0f %12.0f %12.0f %8s\n", kernels[i].name,
+               benchFind(kernels[i].find, text, length, needle, &sink),
+               benchFind(kernels[i].find, text, length, "=", &sink),
+               benchCase(kernels[i].convertCase, dest, text, length),
+               kernelsAgree(kernels[i].find, kernels[i].convertCase) ? "yes" : "no");
+    }
+    free(text);
+    free(dest);
+    if (sink == 42)
+    {
+        printf("\n"); // keeps the searches from being optimized away
+    }
+}
\ No newline at end of file
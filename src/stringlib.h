@@ -0,0 +1,26 @@
+#ifndef clox_stringlib_h
+#define clox_stringlib_h
+
+#include "common.h"
+#include "value.h"
+
+// String natives, registered as globals by initVM(). Searching and case
+// conversion go through SSE2 or AVX2 kernels on x86-64, picked at startup,
+// with a scalar version everywhere else. Results are allocated like any
+// string computed at run time, so they follow --lazy-intern.
+void initStringLib();
+const char *stringLibImplementation();
+void benchStrings();
+Value substringNative(int argCount, Value *args);
+Value lengthNative(int argCount, Value *args);
+Value indexOfNative(int argCount, Value *args);
+Value containsNative(int argCount, Value *args);
+Value countNative(int argCount, Value *args);
+Value splitNative(int argCount, Value *args);
+Value replaceNative(int argCount, Value *args);
+Value trimNative(int argCount, Value *args);
+Value toStringNative(int argCount, Value *args);
+Value upperNative(int argCount, Value *args);
+Value lowerNative(int argCount, Value *args);
+
+#endif
\ No newline at end of file
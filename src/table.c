@@ -1,175 +1,434 @@
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "gcstats.h"
+#include "hash.h"
 #include "memory.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
 
-#define TABLE_MAX_LOAD 0.75
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TABLE_MAX_LOAD 0.875 // counting deleted slots, so every probe meets an empty one
+#define CONTROL_EMPTY 0x00 // zeroed memory is an empty table
+#define CONTROL_DELETED 0x01
+
+typedef uint32_t GroupMask; // bit i stands for the i-th control byte of a group
+
+// the low bits of the hash pick the first slot, the top 7 are kept as the
+// tag of a full slot, which is the only kind with the high bit set
+static inline uint8_t hashTag(uint32_t hash)
+{
+    return (uint8_t)(0x80 | hash >> 25);
+}
+
+#ifdef __SSE2__
+static inline GroupMask groupMatch(const uint8_t *group, uint8_t control)
+{
+    __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)control)));
+}
+
+static inline GroupMask groupMatchAvailable(const uint8_t *group)
+{
+    return ~(GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group)) & 0xffff;
+}
+#else
+static inline GroupMask groupMatch(const uint8_t *group, uint8_t control)
+{
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; i++)
+    {
+        mask |= (GroupMask)(group[i] == control) << i;
+    }
+    return mask;
+}
+
+static inline GroupMask groupMatchAvailable(const uint8_t *group)
+{
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; i++)
+    {
+        mask |= (GroupMask)(group[i] < 0x80) << i;
+    }
+    return mask;
+}
+#endif
+
+static size_t tableBytes(int capacity)
+{
+    return sizeof(Entry) * capacity + capacity + TABLE_GROUP_WIDTH;
+}
+
+static int incrementalMin = TABLE_INCREMENTAL_MIN; // benchTable() turns it off to compare
 
 void initTable(Table *table)
 {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
+    table->statsType = -1;
     table->entries = NULL;
+    table->control = NULL;
+    table->oldCount = 0;
+    table->oldCapacity = 0;
+    table->rehashIndex = 0;
+    table->oldEntries = NULL;
+    table->oldControl = NULL;
+}
+
+static void countArrays(Table *table, size_t oldSize, size_t newSize)
+{
+    if (table->statsType >= 0)
+    {
+        gcStatsResize((ObjType)table->statsType, oldSize, newSize);
+    }
+}
+
+static void freeOldArrays(Table *table)
+{
+    if (table->oldCapacity > 0)
+    {
+        FREE_ARRAY(char, (char *)table->oldEntries, tableBytes(table->oldCapacity));
+        countArrays(table, tableBytes(table->oldCapacity), 0);
+    }
+    table->oldCount = 0;
+    table->oldCapacity = 0;
+    table->rehashIndex = 0;
+    table->oldEntries = NULL;
+    table->oldControl = NULL;
 }
 
 void freeTable(Table *table)
 {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    freeOldArrays(table);
+    if (table->capacity > 0)
+    {
+        FREE_ARRAY(char, (char *)table->entries, tableBytes(table->capacity));
+        countArrays(table, tableBytes(table->capacity), 0);
+    }
+    int statsType = table->statsType;
     initTable(table);
+    table->statsType = statsType;
+}
+
+static void setControl(Table *table, int index, uint8_t control)
+{
+    table->control[index] = control;
+    // the bytes past the end repeat the first ones, so a group can start at any slot
+    for (int mirror = index; mirror < TABLE_GROUP_WIDTH; mirror += table->capacity)
+    {
+        table->control[table->capacity + mirror] = control;
+    }
 }
 
-static Entry *findEntry(Entry *entries, int capacity, ObjString *key)
+// Probes a group at the slot the hash points to, then groups further and
+// further away (by triangular numbers of groups), which reaches every slot
+// of a power of two table. A group with an empty slot ends the search.
+static int findKey(Table *table, ObjString *key)
 {
-    Entry *tombstone = NULL;
-    uint32_t index = key->hash % capacity;
-    for (;;)
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t position = key->hash & mask;
+    uint8_t tag = hashTag(key->hash);
+    for (uint32_t step = TABLE_GROUP_WIDTH;; step += TABLE_GROUP_WIDTH)
     {
-        Entry *entry = &entries[index];
-        if (entry->key == NULL)
+        const uint8_t *group = table->control + position;
+        for (GroupMask matches = groupMatch(group, tag); matches != 0; matches &= matches - 1)
         {
-            if (IS_NIL(entry->value)) // truly empty (means key wasn't found)
-            {
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else // tombstone
+            uint32_t index = (position + __builtin_ctz(matches)) & mask;
+            if (table->entries[index].key == key)
             {
-                if (tombstone == NULL)
-                {
-                    tombstone = entry;
-                }
+                return (int)index;
             }
-            return entry;
         }
-        else if (entry->key == key)
+        if (groupMatch(group, CONTROL_EMPTY) != 0)
         {
-            return entry;
+            return -1;
         }
-        index = (index + 1) % capacity;
+        position = (position + step) & mask;
     }
-    return NULL; // unreachable
 }
 
-ObjString *tableFindString(Table *table, char *chars, int length, uint32_t hash)
+// the first empty or deleted slot on the probe sequence of hash
+static int findAvailable(Table *table, uint32_t hash)
 {
-    if (table->count == 0)
-    {
-        return NULL;
-    }
-    uint32_t index = hash % table->capacity;
-    for (;;)
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t position = hash & mask;
+    for (uint32_t step = TABLE_GROUP_WIDTH;; step += TABLE_GROUP_WIDTH)
     {
-        Entry *entry = &table->entries[index];
-        if (entry->key == NULL)
+        GroupMask available = groupMatchAvailable(table->control + position);
+        if (available != 0)
         {
-            if (IS_NIL(entry->value)) // truly empty (means key wasn't found)
-            {
-                return NULL;
-            }
+            return (int)((position + __builtin_ctz(available)) & mask);
         }
-        else if (entry->key->length == length && entry->key->hash == hash &&
-                 memcmp(entry->key->chars, chars, length) == 0)
+        position = (position + step) & mask;
+    }
+}
+
+static void insertEntry(Table *table, ObjString *key, Value value)
+{
+    int index = findAvailable(table, key->hash);
+    if (table->control[index] == CONTROL_DELETED)
+    {
+        table->tombstones--;
+    }
+    setControl(table, index, hashTag(key->hash));
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    table->count++;
+}
+
+static void deleteEntry(Table *table, int index)
+{
+    // A probe only goes on past a group without empty slots. When the full
+    // slots around this one are too few to fill a group, no probe can have
+    // gone past it, so it can be empty again instead of a tombstone.
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    GroupMask emptyAfter = groupMatch(table->control + index, CONTROL_EMPTY);
+    GroupMask emptyBefore = groupMatch(table->control + ((index - TABLE_GROUP_WIDTH) & mask), CONTROL_EMPTY);
+    bool neverPassed = table->capacity <= TABLE_GROUP_WIDTH ||
+                       (emptyAfter != 0 && emptyBefore != 0 &&
+                        __builtin_ctz(emptyAfter) + __builtin_clz(emptyBefore << 16) < TABLE_GROUP_WIDTH);
+    if (neverPassed)
+    {
+        setControl(table, index, CONTROL_EMPTY);
+    }
+    else
+    {
+        setControl(table, index, CONTROL_DELETED);
+        table->tombstones++;
+    }
+    table->entries[index].key = NULL;
+    table->entries[index].value = NIL_VAL;
+    table->count--;
+}
+
+// the arrays being drained by a rehash, as a table of their own
+static Table oldArrays(Table *table)
+{
+    Table old;
+    initTable(&old);
+    old.count = table->oldCount;
+    old.capacity = table->oldCapacity;
+    old.entries = table->oldEntries;
+    old.control = table->oldControl;
+    return old;
+}
+
+// Moves the next old slots over to the current arrays. Moved slots become
+// tombstones, since old keys further on may have probed past them.
+static void rehashStep(Table *table, int slots)
+{
+    Table old = oldArrays(table);
+    int end = slots < old.capacity - table->rehashIndex ? table->rehashIndex + slots : old.capacity;
+    for (int i = table->rehashIndex; i < end && old.count > 0; i++)
+    {
+        Entry *entry = &old.entries[i];
+        if (entry->key != NULL)
         {
-            return entry->key;
+            insertEntry(table, entry->key, entry->value);
+            table->count--;
+            setControl(&old, i, CONTROL_DELETED);
+            entry->key = NULL;
+            entry->value = NIL_VAL;
+            old.count--;
         }
-        index = (index + 1) % table->capacity;
     }
-    return NULL; // unreachable
+    table->oldCount = old.count;
+    table->rehashIndex = end;
+    if (end == old.capacity || old.count == 0)
+    {
+        freeOldArrays(table);
+    }
 }
 
-void adjustCapacity(Table *table, int newCapacity)
+// Moves the entries to new arrays, which leaves the tombstones behind. The
+// allocation may collect garbage and so remove entries from the intern table
+// before they are moved. Large tables only swap the arrays here and leave
+// the moving to rehashStep().
+static void resizeTable(Table *table, int capacity)
 {
-    Entry *newEntries = ALLOCATE(Entry, newCapacity);
-    for (int i = 0; i < newCapacity; i++)
+    if (table->oldCapacity > 0)
+    {
+        rehashStep(table, table->oldCapacity);
+    }
+    // All zero bytes is a NULL key with a false value and an empty control
+    // byte. Large buffers are fresh mappings, which the OS hands out zeroed,
+    // so a big table is not written here but page by page as it fills.
+    char *block = ALLOCATE(char, tableBytes(capacity));
+    countArrays(table, 0, tableBytes(capacity));
+    if (!isLargeSize(&vm.largeSpace, tableBytes(capacity)))
     {
-        newEntries[i].key = NULL;
-        newEntries[i].value = NIL_VAL;
+        memset(block, 0, tableBytes(capacity));
+    }
+    Table resized;
+    initTable(&resized);
+    resized.capacity = capacity;
+    resized.statsType = table->statsType;
+    resized.entries = (Entry *)block;
+    resized.control = (uint8_t *)(resized.entries + capacity);
+    if (capacity >= incrementalMin && table->count > 0)
+    {
+        resized.count = table->count;
+        resized.oldCount = table->count;
+        resized.oldCapacity = table->capacity;
+        resized.oldEntries = table->entries;
+        resized.oldControl = table->control;
+        *table = resized;
+        return;
     }
-    table->count = 0; // reset count, because we don't copy tombstones
     for (int i = 0; i < table->capacity; i++)
     {
-        Entry *orig = &table->entries[i];
-        if (orig->key == NULL)
+        Entry *entry = &table->entries[i];
+        if (entry->key != NULL)
         {
-            continue;
+            insertEntry(&resized, entry->key, entry->value);
         }
-        Entry *dest = findEntry(newEntries, newCapacity, orig->key);
-        dest->key = orig->key;
-        dest->value = orig->value;
-        table->count++;
     }
-    FREE_ARRAY(Entry, table->entries, table->capacity);
-    table->entries = newEntries;
-    table->capacity = newCapacity;
+    freeTable(table);
+    *table = resized;
 }
 
-bool tableSet(Table *table, ObjString *key, Value value)
+// the slot of key as numbered by tableSlot(), or -1
+static int findSlot(Table *table, ObjString *key)
 {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    if (table->count == 0)
+    {
+        return -1;
+    }
+    if (table->oldCapacity > 0)
     {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+        rehashStep(table, TABLE_REHASH_STEP);
     }
-    Entry *entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) // don't increment if replacing a tombstone
+    int index = findKey(table, key);
+    if (index < 0 && table->oldCapacity > 0)
     {
-        table->count++;
+        Table old = oldArrays(table);
+        index = findKey(&old, key);
+        return index < 0 ? -1 : table->capacity + index;
     }
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    return index;
 }
 
-bool tableGet(Table *table, ObjString *key, Value *value)
+static void deleteSlot(Table *table, int slot)
+{
+    if (slot < table->capacity)
+    {
+        deleteEntry(table, slot);
+        return;
+    }
+    Table old = oldArrays(table);
+    deleteEntry(&old, slot - table->capacity);
+    table->oldCount = old.count;
+    table->count--;
+}
+
+static ObjString *findString(Table *table, char *chars, int length, uint32_t hash)
+{
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t position = hash & mask;
+    uint8_t tag = hashTag(hash);
+    for (uint32_t step = TABLE_GROUP_WIDTH;; step += TABLE_GROUP_WIDTH)
+    {
+        const uint8_t *group = table->control + position;
+        for (GroupMask matches = groupMatch(group, tag); matches != 0; matches &= matches - 1)
+        {
+            ObjString *key = table->entries[(position + __builtin_ctz(matches)) & mask].key;
+            if (key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0)
+            {
+                return key;
+            }
+        }
+        if (groupMatch(group, CONTROL_EMPTY) != 0)
+        {
+            return NULL;
+        }
+        position = (position + step) & mask;
+    }
+}
+
+ObjString *tableFindString(Table *table, char *chars, int length, uint32_t hash)
 {
     if (table->count == 0)
     {
-        return false;
+        return NULL;
+    }
+    if (table->oldCapacity > 0)
+    {
+        rehashStep(table, TABLE_REHASH_STEP);
     }
-    Entry *entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL)
+    ObjString *key = findString(table, chars, length, hash);
+    if (key == NULL && table->oldCapacity > 0)
     {
+        Table old = oldArrays(table);
+        key = findString(&old, chars, length, hash);
+    }
+    return key;
+}
+
+bool tableSet(Table *table, ObjString *key, Value value)
+{
+    int slot = findSlot(table, key);
+    if (slot >= 0)
+    {
+        tableSlot(table, slot)->value = value;
         return false;
     }
-    *value = entry->value;
+    // the old entries count too, they all end up in the current arrays
+    if (table->count + table->tombstones + 1 > table->capacity * TABLE_MAX_LOAD)
+    {
+        // mostly tombstones: clearing them out is enough
+        bool grow = table->count + 1 > table->capacity * TABLE_MAX_LOAD / 2;
+        resizeTable(table, grow ? GROW_CAPACITY(table->capacity) : table->capacity);
+    }
+    insertEntry(table, key, value);
     return true;
 }
 
-bool tableDelete(Table *table, ObjString *key)
+bool tableGet(Table *table, ObjString *key, Value *value)
 {
-    if (table->count)
+    int slot = findSlot(table, key);
+    if (slot < 0)
     {
         return false;
     }
-    Entry *entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL)
+    *value = tableSlot(table, slot)->value;
+    return true;
+}
+
+bool tableDelete(Table *table, ObjString *key)
+{
+    int slot = findSlot(table, key);
+    if (slot < 0)
     {
         return false;
     }
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true); // tombstone
+    deleteSlot(table, slot);
     return true;
 }
 
 void tableRemoveWhite(Table *table)
 {
-    for (int i = 0; i < table->capacity; i++)
+    for (int i = 0; i < tableSlots(table); i++)
     {
-        Entry *entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked)
+        Entry *entry = tableSlot(table, i);
+        if (entry->key != NULL && !heapIsMarked((Obj *)entry->key))
         {
-            tableDelete(table, entry->key);
+            deleteSlot(table, i);
         }
     }
 }
 
 void tableAddAll(Table *source, Table *dest)
 {
-    for (int i = 0; i < source->capacity; i++)
+    for (int i = 0; i < tableSlots(source); i++)
     {
-        Entry *entry = &source->entries[i];
+        Entry *entry = tableSlot(source, i);
         if (entry->key != NULL)
         {
             tableSet(dest, entry->key, entry->value);
@@ -177,6 +436,82 @@ void tableAddAll(Table *source, Table *dest)
     }
 }
 
+// makes room for count entries, so filling the table never grows it
+void tableReserve(Table *table, int count)
+{
+    int capacity = GROW_CAPACITY(0);
+    while (count > capacity * TABLE_MAX_LOAD)
+    {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    if (capacity > table->capacity)
+    {
+        resizeTable(table, capacity);
+    }
+}
+
+static double benchClockMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// Fills a table with growing all at once and incrementally, timing every
+// insert. The keys are bare strings outside of the heap, only their hash and
+// address matter to a table.
+void benchTable()
+{
+    int keyCount = 4000000;
+    char *keys = calloc((size_t)keyCount, sizeof(ObjString));
+    if (keys == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    char name[16];
+    for (int i = 0; i < keyCount; i++)
+    {
+        int length = snprintf(name, sizeof(name), "key%d", i);
+        ((ObjString *)(keys + (size_t)i * sizeof(ObjString)))->hash = hashString(name, length);
+    }
+    initVM();
+    vm.nextGC = SIZE_MAX; // timing the table, not the collector
+    printf("%-12s %10s %10s %10s %10s\n", "growth", "insert ms", "worst us", "over 1ms", "lookup ns");
+    for (int incremental = 0; incremental < 2; incremental++)
+    {
+        incrementalMin = incremental ? TABLE_INCREMENTAL_MIN : INT_MAX;
+        Table table;
+        initTable(&table);
+        double worstMs = 0;
+        int slowInserts = 0;
+        double startMs = benchClockMs();
+        for (int i = 0; i < keyCount; i++)
+        {
+            double insertStartMs = benchClockMs();
+            tableSet(&table, (ObjString *)(keys + (size_t)i * sizeof(ObjString)), NUMBER_VAL(i));
+            double insertMs = benchClockMs() - insertStartMs;
+            worstMs = insertMs > worstMs ? insertMs : worstMs;
+            slowInserts += insertMs > 1.0;
+        }
+        double insertMs = benchClockMs() - startMs;
+        int found = 0;
+        Value value;
+        startMs = benchClockMs();
+        for (int i = 0; i < keyCount; i++)
+        {
+            found += tableGet(&table, (ObjString *)(keys + (size_t)i * sizeof(ObjString)), &value);
+        }
+        double lookupMs = benchClockMs() - startMs;
+        printf("%-12s %10.1f %10.1f %10d %10.1f%s\n", incremental ? "incremental" : "at once", insertMs,
+               worstMs * 1000, slowInserts, lookupMs * 1e6 / keyCount, found == keyCount ? "" : " (keys lost)");
+        freeTable(&table);
+    }
+    incrementalMin = TABLE_INCREMENTAL_MIN;
+    freeVM();
+    free(keys);
+}
+
 void testHashTable()
 {
     Table table;
@@ -194,13 +529,14 @@ void testHashTable()
         {
             printf("found value for '%.*s': ", keyB->length, keyB->chars);
             printValue(value);
+            flushOutput(&vm.output);
             printf("\n");
         }
         if (tableDelete(&table, keyB))
         {
             printf("deleted\n");
         }
-        if (tableGet(&table, keyB, &value))
+        if (!tableGet(&table, keyB, &value))
         {
             printf("key '%.*s' not found.\n", keyB->length, keyB->chars);
         }
@@ -208,5 +544,66 @@ void testHashTable()
     pop();
     pop();
     freeTable(&table);
+
+    // churn through enough keys to grow, fill with tombstones and rehash;
+    // the globals keep the keys reachable
+    char name[16];
+    bool ok = true;
+    for (int round = 0; round < 4; round++)
+    {
+        for (int i = 0; i < 5000; i++)
+        {
+            int length = snprintf(name, sizeof(name), "k%d", round * 2500 + i);
+            push(OBJ_VAL(copyString(name, length)));
+            tableSet(&vm.globals, AS_STRING(peek(0)), NUMBER_VAL(i));
+            pop();
+        }
+        for (int i = 0; i < 5000; i += 2)
+        {
+            int length = snprintf(name, sizeof(name), "k%d", round * 2500 + i);
+            ok &= tableDelete(&vm.globals, copyString(name, length));
+        }
+    }
+    for (int i = 0; i < 12500; i++)
+    {
+        int length = snprintf(name, sizeof(name), "k%d", i);
+        Value value;
+        bool found = tableGet(&vm.globals, copyString(name, length), &value);
+        ok &= found == (i % 2 == 1);
+    }
+    printf("churn check: %s, %d keys\n", ok ? "ok" : "fail", vm.globals.count);
+
+    // grow past the incremental threshold, deleting old keys while both
+    // arrays are in use
+    bool rehashed = false;
+    ok = true;
+    for (int i = 0; i < 40000; i++)
+    {
+        int length = snprintf(name, sizeof(name), "r%d", i);
+        push(OBJ_VAL(copyString(name, length)));
+        tableSet(&vm.globals, AS_STRING(peek(0)), NUMBER_VAL(i));
+        pop();
+        if (vm.globals.oldCapacity > 0 && i % 3 == 0)
+        {
+            rehashed = true;
+            length = snprintf(name, sizeof(name), "r%d", i - 3000);
+            ok &= tableDelete(&vm.globals, copyString(name, length));
+        }
+    }
+    int deleted = 0;
+    for (int i = 0; i < 40000; i++)
+    {
+        int length = snprintf(name, sizeof(name), "r%d", i);
+        Value value;
+        if (!tableGet(&vm.globals, copyString(name, length), &value))
+        {
+            deleted++;
+        }
+        else
+        {
+            ok &= AS_NUMBER(value) == i;
+        }
+    }
+    printf("rehash check: %s, %d keys deleted\n", ok && rehashed ? "ok" : "fail", deleted);
     freeVM();
 }
\ No newline at end of file
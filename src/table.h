@@ -10,13 +10,47 @@ typedef struct
     Value value;
 } Entry;
 
+// Open addressing in the style of SwissTable. Next to the entries there is
+// one control byte per slot: empty, deleted, or 7 bits of the key's hash for
+// a full slot. Lookups compare a group of 16 control bytes at once and only
+// look at the entries whose bits match. Slots that are not full have a NULL
+// key, so the entries can be walked on their own.
+#define TABLE_GROUP_WIDTH 16
+
+// Tables of at least TABLE_INCREMENTAL_MIN slots grow incrementally: the old
+// arrays are kept next to the new ones and every operation moves the next
+// TABLE_REHASH_STEP old slots over, so no single insert pays for the whole
+// rehash. Until that is done lookups check both.
+#define TABLE_INCREMENTAL_MIN (64 * 1024)
+#define TABLE_REHASH_STEP 64
+
 typedef struct
 {
-    int count;
-    int capacity;
+    int count;      // full slots, old ones included
+    int tombstones; // deleted slots, they still lengthen probes until the next rehash
+    int capacity;   // a power of two
+    int statsType;  // ObjType the arrays are counted under in the GC stats, -1 for the VM's tables
     Entry *entries;
+    uint8_t *control; // capacity + TABLE_GROUP_WIDTH bytes, allocated with the entries
+    // arrays still being moved by an incremental rehash, oldCapacity is 0 otherwise
+    int oldCount;
+    int oldCapacity;
+    int rehashIndex; // old slots below this were moved
+    Entry *oldEntries;
+    uint8_t *oldControl;
 } Table;
 
+// Walks every slot, old ones last: for (i < tableSlots(table)) tableSlot(table, i)
+static inline int tableSlots(Table *table)
+{
+    return table->capacity + table->oldCapacity;
+}
+
+static inline Entry *tableSlot(Table *table, int index)
+{
+    return index < table->capacity ? &table->entries[index] : &table->oldEntries[index - table->capacity];
+}
+
 void initTable(Table *table);
 void freeTable(Table *table);
 bool tableSet(Table *table, ObjString *key, Value value);
@@ -25,5 +59,7 @@ bool tableDelete(Table *table, ObjString *key);
 ObjString *tableFindString(Table *table, char *chars, int length, uint32_t hash);
 void tableRemoveWhite(Table *table);
 void tableAddAll(Table *source, Table *dest);
+void tableReserve(Table *table, int count);
+void benchTable();
 
 #endif
\ No newline at end of file
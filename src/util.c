@@ -4,6 +4,8 @@
 #include "common.h"
 #include "util.h"
 #include "vm.h"
+#include "memory.h"
+#include "config.h"
 
 char *readFile(const char *path)
 {
@@ -65,6 +67,34 @@ void runFile(const char *path)
     run(source);
 }
 
+// Runs each script in turn on the same VM, so later scripts see the globals
+// of earlier ones. The gap between scripts is idle time for the collector.
+int runBatch(int count, const char **paths)
+{
+    int exitCode = 0;
+    initVM();
+    for (int i = 0; i < count; i++)
+    {
+        if (i > 0)
+        {
+            gcIdle(config.gcIdleBudget);
+        }
+        char *source = readFile(paths[i]);
+        InterpretResult result = interpret(source);
+        free(source);
+        if (result == INTERPRET_COMPILE_ERROR && exitCode == 0)
+        {
+            exitCode = 65;
+        }
+        else if (result == INTERPRET_RUNTIME_ERROR && exitCode == 0)
+        {
+            exitCode = 70;
+        }
+    }
+    freeVM();
+    return exitCode;
+}
+
 void evaluate(const char *path)
 {
     char *source = readFile(path);
@@ -3,6 +3,7 @@
 
 char *readFile(const char *path);
 void runFile(const char *path);
+int runBatch(int count, const char **paths);
 void evaluate(const char *path);
 
 #endif
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "memory.h"
 #include "value.h"
 #include "object.h"
+#include "number.h"
+#include "vm.h"
 
 void initValueArray(ValueArray *array)
 {
@@ -34,14 +36,24 @@ void printValue(Value value)
     switch (value.type)
     {
     case VAL_NIL:
-        printf("nil");
+        writeOutput(&vm.output, "nil", 3);
         break;
     case VAL_BOOL:
-        printf("%s", AS_BOOL(value) ? "true" : "false");
+        if (AS_BOOL(value))
+        {
+            writeOutput(&vm.output, "true", 4);
+        }
+        else
+        {
+            writeOutput(&vm.output, "false", 5);
+        }
         break;
     case VAL_NUMBER:
-        printf("%.15g", AS_NUMBER(value));
+    {
+        char buffer[NUMBER_BUFFER_SIZE];
+        writeOutput(&vm.output, buffer, formatNumber(AS_NUMBER(value), buffer));
         break;
+    }
     case VAL_OBJ:
         printObject(value);
         break;
@@ -67,7 +79,17 @@ bool valuesEqual(Value a, Value b)
     case VAL_NUMBER:
         return AS_NUMBER(a) == AS_NUMBER(b);
     case VAL_OBJ:
-        return AS_OBJ(a) == AS_OBJ(b);
+        if (AS_OBJ(a) == AS_OBJ(b))
+        {
+            return true;
+        }
+        // ropes and lazily interned strings need a closer look. Flattening
+        // allocates, so both operands must still be reachable.
+        if (IS_STRING(a) && IS_STRING(b))
+        {
+            return stringsEqual(AS_STRING(a), AS_STRING(b));
+        }
+        return false;
     default:
         return false; // unreachable
     }
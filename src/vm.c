@@ -9,6 +9,14 @@
 #include "object.h"
 #include "memory.h"
 #include "compiler.h"
+#include "config.h"
+#include "gcstats.h"
+#include "pacer.h"
+#include "freer.h"
+#include "arena.h"
+#include "rc.h"
+#include "gctrace.h"
+#include "stringlib.h"
 
 VM vm;
 
@@ -16,10 +24,12 @@ static void resetStack()
 {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
+    vm.openUpvalues = NULL; // batch mode keeps using the VM after a runtime error
 }
 
 static void runtimeError(const char *format, ...)
 {
+    flushOutput(&vm.output); // what was printed before the error comes first
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
@@ -29,15 +39,22 @@ static void runtimeError(const char *format, ...)
     for (int i = vm.frameCount - 1; i >= 0; i--)
     {
         CallFrame *frame = &vm.frames[i];
-        ObjFunction *function = frame->closure->function;
+        ObjFunction *function = DEREF(ObjFunction, frame->closure->function);
+        ObjString *name = DEREF(ObjString, function->name);
         size_t offset = frame->ip - function->chunk.code - 1;
         int line = function->chunk.lines[offset];
-        fprintf(stderr, "[line %d] in %s\n", line,
-                function->name != NULL ? function->name->chars : "script");
+        fprintf(stderr, "[line %d] in %s\n", line, name != NULL ? name->chars : "script");
     }
     resetStack();
 }
 
+// natives return this to raise a runtime error once they are back in the VM
+Value nativeError(const char *message)
+{
+    vm.nativeError = message;
+    return NIL_VAL;
+}
+
 void push(Value value)
 {
     *vm.stackTop = value;
@@ -60,12 +77,29 @@ static Value clockNative(int argCount, Value *args)
     return NUMBER_VAL((double)time(NULL));
 }
 
-static void defineNative(char *name, NativeFn function)
+// lets the host do collector work while the script has nothing else to do
+static Value gcIdleNative(int argCount, Value *args)
+{
+    if (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 0)
+    {
+        return nativeError("Idle budget must be a non-negative number of milliseconds.");
+    }
+    return NUMBER_VAL(gcIdle(AS_NUMBER(args[0])));
+}
+
+// writes out what was printed so far, for line by line progress in full mode
+static Value flushNative(int argCount, Value *args)
+{
+    flushOutput(&vm.output);
+    return NIL_VAL;
+}
+
+static void defineNative(char *name, NativeFn function, int arity)
 {
     // push/pop these values to avoid the GC (when it's implemented)
     // to collect them while they are being used
     push(OBJ_VAL(copyString(name, strlen(name))));
-    push(OBJ_VAL(newNative(function)));
+    push(OBJ_VAL(newNative(function, arity)));
     tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
     pop();
     pop();
@@ -74,27 +108,81 @@ static void defineNative(char *name, NativeFn function)
 void initVM()
 {
     resetStack();
-    vm.objects = NULL;
+    initOutput(&vm.output, config.outputMode);
+    if (config.gcTrace != NULL)
+    {
+        startGCTrace(config.gcTrace, config.gcTracePrecision);
+    }
+    initHeap(&vm.heap);
+    initLargeSpace(&vm.largeSpace, config.gcLargeThreshold);
     vm.openUpvalues = NULL;
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayMarks = NULL;
+    vm.viewCount = 0;
+    vm.viewCapacity = 0;
+    vm.views = NULL;
     vm.bytesAllocated = 0;
-    vm.nextGC = 1024;
+    vm.nextGC = config.gcInitialHeap;
+    if (config.arena)
+    {
+        initArena(config.arenaCeiling);
+        vm.nextGC = config.arenaCeiling;
+    }
+    vm.bytesMarked = 0;
+    vm.objectsMarked = 0;
+    vm.compactPending = false;
+    vm.nativeError = NULL;
     vm.initString = NULL; // make sure GC is happy if invoked inside copyString
+    vm.selectorCount = 0;
     initTable(&vm.globals);
     initTable(&vm.strings);
-    defineNative("clock", clockNative);
+    initGCStats();
+    initPacer();
+    initRefCounts();
+    if (config.gcFreeThread)
+    {
+        initFreer();
+    }
+    defineNative("clock", clockNative, 0);
+    defineNative("gcStats", gcStatsNative, 0);
+    defineNative("gcIdle", gcIdleNative, 1);
+    defineNative("flush", flushNative, 0);
+    defineNative("substring", substringNative, 3);
+    defineNative("length", lengthNative, 1);
+    defineNative("indexOf", indexOfNative, -1);
+    defineNative("contains", containsNative, 2);
+    defineNative("count", countNative, 2);
+    defineNative("split", splitNative, 3);
+    defineNative("replace", replaceNative, 3);
+    defineNative("trim", trimNative, 1);
+    defineNative("upper", upperNative, 1);
+    defineNative("lower", lowerNative, 1);
+    defineNative("toString", toStringNative, 1);
     vm.initString = copyString("init", 4);
+    assignSelector(vm.initString);
 }
 
 void freeVM()
 {
+    flushOutput(&vm.output);
+    if (config.gcStats != GC_STATS_OFF)
+    {
+        printGCStats(stderr, config.gcStats == GC_STATS_JSON);
+    }
+    stopGCTrace(); // objects still alive at the end are not traced as freed
     freeTable(&vm.globals);
     freeTable(&vm.strings);
     free(vm.grayMarks);
+    vm.viewCount = 0;
+    free(vm.views);
     vm.initString = NULL;
     freeObjects();
+    freeRefCounts();
+    if (config.gcFreeThread)
+    {
+        stopFreer();
+    }
 }
 
 static bool isFalsey(Value value)
@@ -108,11 +196,25 @@ static void concatenate()
     ObjString *b = AS_STRING(peek(0));
     ObjString *a = AS_STRING(peek(1));
     int length = a->length + b->length;
-    char *chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-    ObjString *result = takeString(chars, length);
+    ObjString *result;
+    if (a->length == 0 || b->length == 0)
+    {
+        result = a->length == 0 ? b : a;
+    }
+    else if (stringIsInline(length))
+    {
+        // short results are joined on the stack and copied straight into the
+        // string. Both operands are short too, so neither is a rope.
+        char chars[STRING_INLINE_MAX + 1];
+        memcpy(chars, a->chars, a->length);
+        memcpy(chars + a->length, b->chars, b->length);
+        result = copyRuntimeString(chars, length);
+    }
+    else
+    {
+        // long results are joined lazily, so building a string piece by piece stays linear
+        result = newRope(a, b);
+    }
     pop();
     pop();
     push(OBJ_VAL(result));
@@ -120,9 +222,10 @@ static void concatenate()
 
 static bool call(ObjClosure *closure, int argCount)
 {
-    if (closure->function->arity != argCount)
+    ObjFunction *function = DEREF(ObjFunction, closure->function);
+    if (function->arity != argCount)
     {
-        runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
+        runtimeError("Expected %d arguments but got %d.", function->arity, argCount);
         return false;
     }
     if (vm.frameCount == FRAMES_MAX)
@@ -132,7 +235,7 @@ static bool call(ObjClosure *closure, int argCount)
     }
     CallFrame *frame = &vm.frames[vm.frameCount++];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
+    frame->ip = function->chunk.code;
     frame->slots = vm.stackTop - argCount - 1;
     return true;
 }
@@ -145,8 +248,20 @@ static bool callValue(Value callee, int argCount)
         {
         case OBJ_NATIVE:
         {
-            NativeFn native = AS_NATIVE(callee);
-            Value result = native(argCount, vm.stackTop - argCount);
+            ObjNative *native = (ObjNative *)AS_OBJ(callee);
+            if (native->arity >= 0 && argCount != native->arity)
+            {
+                runtimeError("Expected %d arguments but got %d.", native->arity, argCount);
+                return false;
+            }
+            Value result = native->function(argCount, vm.stackTop - argCount);
+            if (vm.nativeError != NULL)
+            {
+                const char *message = vm.nativeError;
+                vm.nativeError = NULL;
+                runtimeError("%s", message);
+                return false;
+            }
             vm.stackTop -= argCount + 1;
             push(result);
             return true;
@@ -158,17 +273,17 @@ static bool callValue(Value callee, int argCount)
             ObjBoundMethod *bound = AS_BOUND_METHOD(callee);
             // place receiver before arguments on slot 0 (referenced as 'this')
             vm.stackTop[-argCount - 1] = bound->receiver;
-            return call(bound->method, argCount);
+            return call(DEREF(ObjClosure, bound->method), argCount);
         }
         case OBJ_CLASS:
         {
             ObjClass *klass = AS_CLASS(callee);
             // place instance on the stack before arguments (slot 0 in callframe was reserved)
             vm.stackTop[-argCount - 1] = OBJ_VAL(newInstance(klass));
-            Value initializer;
-            if (tableGet(&klass->methods, vm.initString, &initializer))
+            ObjClosure *initializer = DEREF(ObjClosure, klass->initializer);
+            if (initializer != NULL)
             {
-                return call(AS_CLOSURE(initializer), argCount);
+                return call(initializer, argCount);
             }
             else if (argCount != 0) // if class doesn't have an initializer, it expects no arguments
             {
@@ -195,7 +310,7 @@ static ObjUpvalue *captureUpvalue(Value *local)
     while (upvalue != NULL && upvalue->location > local)
     {
         prevUpvalue = upvalue;
-        upvalue = upvalue->next;
+        upvalue = DEREF(ObjUpvalue, upvalue->next);
     }
     if (upvalue != NULL && upvalue->location == local)
     {
@@ -203,14 +318,14 @@ static ObjUpvalue *captureUpvalue(Value *local)
     }
     // if not found, added it to the list at the sorted location
     ObjUpvalue *createdUpvalue = newUpvalue(local);
-    createdUpvalue->next = upvalue;
+    createdUpvalue->next = TO_REF(upvalue);
     if (prevUpvalue == NULL)
     {
         vm.openUpvalues = createdUpvalue;
     }
     else
     {
-        prevUpvalue->next = createdUpvalue;
+        prevUpvalue->next = TO_REF(createdUpvalue);
     }
     return createdUpvalue;
 }
@@ -222,28 +337,21 @@ static void closeUpvalues(Value *last)
     {
         ObjUpvalue *upvalue = vm.openUpvalues;
         upvalue->closed = *upvalue->location; // copy value from stack into ObjUpvalue storage (heap)
+        rcWrite((Obj *)upvalue, NIL_VAL, upvalue->closed);
         upvalue->location = &upvalue->closed; // move reference to own copy
-        vm.openUpvalues = upvalue->next;
+        vm.openUpvalues = DEREF(ObjUpvalue, upvalue->next);
     }
 }
 
-static void defineMethod(ObjString *name)
-{
-    Value method = peek(0);
-    ObjClass *klass = AS_CLASS(peek(1));
-    tableSet(&klass->methods, name, method);
-    pop(); // method (closure)
-}
-
 static bool bindMethod(ObjClass *klass, ObjString *name)
 {
-    Value method;
-    if (!tableGet(&klass->methods, name, &method))
+    ObjClosure *method = findMethod(klass, name);
+    if (method == NULL)
     {
         runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
-    ObjBoundMethod *bound = newBoundMethod(peek(0), AS_CLOSURE(method));
+    ObjBoundMethod *bound = newBoundMethod(peek(0), method);
     pop();
     push(OBJ_VAL(bound));
     return true;
@@ -251,13 +359,13 @@ static bool bindMethod(ObjClass *klass, ObjString *name)
 
 static bool invokeFromClass(ObjClass *klass, ObjString *methodName, int argCount)
 {
-    Value method;
-    if (!tableGet(&klass->methods, methodName, &method))
+    ObjClosure *method = findMethod(klass, methodName);
+    if (method == NULL)
     {
         runtimeError("Undefined property '%s'.", methodName->chars);
         return false;
     }
-    return call(AS_CLOSURE(method), argCount);
+    return call(method, argCount);
 }
 
 static bool invoke(ObjString *methodName, int argCount)
@@ -269,15 +377,16 @@ static bool invoke(ObjString *methodName, int argCount)
         return false;
     }
     ObjInstance *instance = AS_INSTANCE(receiver);
-    // method might be actually a function assigned to a field
+    // method might be actually a function assigned to a field, which can
+    // only be when some instance ever had a field of that name
     Value value;
-    if (tableGet(&instance->fields, methodName, &value))
+    if ((methodName->obj.flags & STRING_FIELD_NAME) && tableGet(&instance->fields, methodName, &value))
     {
         // place closure at slot 0 and do regular call instead of method invocation
         vm.stackTop[-argCount - 1] = value;
         return callValue(value, argCount);
     }
-    return invokeFromClass(instance->klass, methodName, argCount);
+    return invokeFromClass(DEREF(ObjClass, instance->klass), methodName, argCount);
 }
 
 static InterpretResult run()
@@ -286,7 +395,7 @@ static InterpretResult run()
 
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT() (((uint16_t)READ_BYTE() << 8) | READ_BYTE())
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#define READ_CONSTANT() (DEREF(ObjFunction, frame->closure->function)->chunk.constants.values[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 #define BINARY_OP(valueType, op)                        \
     {                                                   \
@@ -312,11 +421,12 @@ static InterpretResult run()
         {
             printf("[ ");
             printValue(*slot);
+            flushOutput(&vm.output);
             printf(" ]");
         }
         printf("\n");
-        disassembleInstruction(&frame->closure->function->chunk,
-                               (int)(frame->ip - frame->closure->function->chunk.code));
+        ObjFunction *function = DEREF(ObjFunction, frame->closure->function);
+        disassembleInstruction(&function->chunk, (int)(frame->ip - function->chunk.code));
 #endif
         uint8_t instruction = READ_BYTE();
         switch (instruction)
@@ -386,16 +496,16 @@ static InterpretResult run()
             break;
         case OP_EQUAL:
         {
-            Value b = pop();
-            Value a = pop();
-            push(BOOL_VAL(valuesEqual(a, b)));
+            bool equal = valuesEqual(peek(1), peek(0)); // ropes may be flattened
+            vm.stackTop -= 2;
+            push(BOOL_VAL(equal));
             break;
         }
         case OP_NOT_EQUAL:
         {
-            Value b = pop();
-            Value a = pop();
-            push(BOOL_VAL(!valuesEqual(a, b)));
+            bool equal = valuesEqual(peek(1), peek(0)); // ropes may be flattened
+            vm.stackTop -= 2;
+            push(BOOL_VAL(!equal));
             break;
         }
         case OP_CONSTANT:
@@ -405,6 +515,10 @@ static InterpretResult run()
         {
             ObjString *name = READ_STRING();
             tableSet(&vm.globals, name, peek(0));
+            if (gcTracing())
+            {
+                gcTraceRoot(peek(0));
+            }
             pop();
             break;
         }
@@ -430,6 +544,10 @@ static InterpretResult run()
                 runtimeError("Undefined variable '%s'.", name->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
+            if (gcTracing())
+            {
+                gcTraceRoot(peek(0));
+            }
             // leave the value on the stack. Ex: a = (b = 1)
             break;
         }
@@ -448,7 +566,7 @@ static InterpretResult run()
         }
         case OP_PRINT:
             printValue(pop());
-            printf("\n");
+            endOutputLine(&vm.output);
             break;
         case OP_JUMP_IF_FALSE:
         {
@@ -469,10 +587,26 @@ static InterpretResult run()
         {
             uint16_t offset = READ_SHORT();
             frame->ip -= offset;
+            if (vm.viewCount > 0)
+            {
+                detachViews();
+            }
+            if (vm.compactPending)
+            {
+                compactHeap();
+            }
             break;
         }
         case OP_CALL:
         {
+            if (vm.viewCount > 0)
+            {
+                detachViews();
+            }
+            if (vm.compactPending)
+            {
+                compactHeap();
+            }
             int argCount = READ_BYTE();
             Value function = peek(argCount);
             if (!callValue(function, argCount))
@@ -495,26 +629,33 @@ static InterpretResult run()
                 if (isLocal)
                 {
                     // capture the upvalue directly from the local function
-                    closure->upvalues[i] = captureUpvalue(frame->slots + index);
+                    closure->upvalues[i] = TO_REF(captureUpvalue(frame->slots + index));
                 }
                 else
                 {
                     // point to the enclosing function's upvalue
                     closure->upvalues[i] = frame->closure->upvalues[index];
                 }
+                // capturing may have allocated, the closure is not necessarily new anymore
+                rcWrite((Obj *)closure, NIL_VAL, OBJ_VAL(DEREF(ObjUpvalue, closure->upvalues[i])));
             }
             break;
         }
         case OP_GET_UPVALUE:
         {
             uint8_t slot = READ_BYTE();
-            push(*frame->closure->upvalues[slot]->location);
+            push(*DEREF(ObjUpvalue, frame->closure->upvalues[slot])->location);
             break;
         }
         case OP_SET_UPVALUE:
         {
             uint8_t slot = READ_BYTE();
-            *frame->closure->upvalues[slot]->location = peek(0);
+            ObjUpvalue *upvalue = DEREF(ObjUpvalue, frame->closure->upvalues[slot]);
+            if (upvalue->location == &upvalue->closed)
+            {
+                rcWrite((Obj *)upvalue, upvalue->closed, peek(0)); // stack slots are not counted
+            }
+            *upvalue->location = peek(0);
             // leave the value on the stack
             break;
         }
@@ -551,8 +692,17 @@ static InterpretResult run()
             }
             ObjInstance *instance = AS_INSTANCE(peek(1));
             ObjString *name = READ_STRING();
+            name->obj.flags |= STRING_FIELD_NAME;
+            // the value stays on the stack while the table may grow
+            if (rcTableSet((Obj *)instance, &instance->fields, name, peek(0)))
+            {
+                ObjClass *klass = DEREF(ObjClass, instance->klass);
+                if (instance->fields.count > klass->fieldsHint && instance->fields.count <= FIELDS_HINT_MAX)
+                {
+                    klass->fieldsHint = instance->fields.count;
+                }
+            }
             Value value = pop();
-            tableSet(&instance->fields, name, value);
             pop(); // instance
             push(value);
             break;
@@ -573,14 +723,15 @@ static InterpretResult run()
                 push(value);
                 break;
             }
-            if (!bindMethod(instance->klass, name))
+            if (!bindMethod(DEREF(ObjClass, instance->klass), name))
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
             break;
         }
         case OP_METHOD:
-            defineMethod(READ_STRING());
+            defineMethod(AS_CLASS(peek(1)), READ_STRING(), AS_CLOSURE(peek(0)));
+            pop(); // method (closure)
             break;
         case OP_INHERIT:
         {
@@ -591,7 +742,7 @@ static InterpretResult run()
                 return INTERPRET_RUNTIME_ERROR;
             }
             ObjClass *subClass = AS_CLASS(peek(0));
-            tableAddAll(&AS_CLASS(superClass)->methods, &subClass->methods);
+            inheritMethods(subClass, AS_CLASS(superClass));
             pop(); // subClass
             break;
         }
@@ -656,7 +807,9 @@ InterpretResult interpret(char *source)
     pop();
     push(OBJ_VAL(closure));
     call(closure, 0);
-    return run();
+    InterpretResult result = run();
+    flushOutput(&vm.output);
+    return result;
 }
 
 void testVM()
@@ -4,6 +4,9 @@
 #include "chunk.h"
 #include "table.h"
 #include "object.h"
+#include "heap.h"
+#include "largespace.h"
+#include "output.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
@@ -21,16 +24,26 @@ typedef struct
     int frameCount;
     Value stack[STACK_MAX];
     Value *stackTop;
-    Obj *objects;
+    Heap heap;
+    LargeSpace largeSpace;
     Table globals;
     Table strings;
     ObjString *initString;
+    int selectorCount; // method names given a selector ID so far
     ObjUpvalue *openUpvalues;
     int grayCount;
     int grayCapacity;
     Obj **grayMarks;
+    int viewCount; // views met while marking, then the ones due to be detached
+    int viewCapacity;
+    ObjView **views;
     size_t bytesAllocated;
     size_t nextGC;
+    size_t bytesMarked;
+    size_t objectsMarked;
+    bool compactPending;
+    const char *nativeError; // set by a native that failed, reported by the caller
+    Output output;
 } VM;
 
 typedef enum
@@ -47,6 +60,7 @@ void freeVM();
 void push(Value value);
 Value pop();
 Value peek(int distance);
+Value nativeError(const char *message);
 InterpretResult interpret(char *source);
 
 #endif
\ No newline at end of file
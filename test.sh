@@ -30,9 +30,35 @@ set -e # Exit early if any commands fail
     $(dirname $0)/build/interpreter run tests/native.lox
     $(dirname $0)/build/interpreter run tests/fun.lox
     $(dirname $0)/build/interpreter run tests/closure.lox
+    $(dirname $0)/build/interpreter run tests/closureidentity.lox
     $(dirname $0)/build/interpreter run tests/class.lox
     $(dirname $0)/build/interpreter run tests/inheritance.lox
     $(dirname $0)/build/interpreter run tests/invoke.lox
+    $(dirname $0)/build/interpreter run tests/gc.lox
+    $(dirname $0)/build/interpreter run tests/gc.lox --gc-compact-threshold=0.3
+    $(dirname $0)/build/interpreter run tests/gcstats.lox
+    $(dirname $0)/build/interpreter run tests/memorylimit.lox --gc-cgroup-file=tests/memory.max
+    $(dirname $0)/build/interpreter run tests/memorylimit.lox --gc-memory-limit=2m
+    $(dirname $0)/build/interpreter run tests/gc.lox --gc-free-thread
+    $(dirname $0)/build/interpreter run tests/gc.lox --arena
+    $(dirname $0)/build/interpreter run tests/gc.lox --arena-ceiling=2m
+    $(dirname $0)/build/interpreter run tests/largestring.lox
+    $(dirname $0)/build/interpreter run tests/gc.lox --gc-mark-prefetch=0
+    $(dirname $0)/build/interpreter run tests/rc.lox
+    $(dirname $0)/build/interpreter run tests/rc.lox --gc-mode=rc
+    $(dirname $0)/build/interpreter run tests/gc.lox --gc-mode=rc
+    $(dirname $0)/build/interpreter run tests/inheritance.lox --gc-mode=rc
+    $(dirname $0)/build/interpreter run tests/idle.lox
+    $(dirname $0)/build/interpreter batch tests/runtimeerror.lox tests/gc.lox tests/closure.lox
+    $(dirname $0)/build/interpreter run tests/closure.lox --gc-trace=/dev/null --gc-trace-precision=16k
+    $(dirname $0)/build/interpreter run tests/rope.lox
+    $(dirname $0)/build/interpreter run tests/intern.lox --lazy-intern
+    $(dirname $0)/build/interpreter run tests/substring.lox
+    $(dirname $0)/build/interpreter run tests/stringlib.lox
+    $(dirname $0)/build/interpreter run tests/tostring.lox
+    $(dirname $0)/build/interpreter run tests/output.lox --output=full
+    $(dirname $0)/build/interpreter run tests/dispatch.lox
+    $(dirname $0)/build/interpreter run tests/construct.lox
 ) > tests/output.log 2>&1
 
 diff --color=auto tests/base.log tests/output.log
\ No newline at end of file
@@ -0,0 +1,741 @@
+// Replays an allocation trace recorded with --gc-trace=FILE against other
+// collector policies and reports the pauses and peak heap each one would
+// have produced.
+//
+//   gcsim TRACE [--growth=1.5,2,3] [--nursery=0,1m] [--budget=0,500]
+//               [--min-heap=1m]
+//
+// The clock is the number of bytes allocated so far. Object lifetimes come
+// from the traced run: an object freed by a sweep died at the latest by the
+// collection before it, so tracing with --gc-trace-precision=SIZE makes the
+// lifetimes sharper. Pause times are modelled from the traced marking cost
+// per surviving object. Bytes owned outside of slots (string characters,
+// arrays) are replayed as they were in the traced run.
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gctrace.h"
+
+#define MAX_POLICIES 16
+#define SLICE_BYTES (64 * 1024) // allocation between two incremental slices
+#define NEVER UINT64_MAX
+
+typedef struct
+{
+    uint64_t birth;
+    uint64_t death;
+    uint32_t size;
+    bool root;
+    // simulation state
+    bool old;
+    bool remembered;
+} SimObject;
+
+typedef enum
+{
+    EVENT_ALLOC,
+    EVENT_BYTES,
+    EVENT_STORE,
+} EventKind;
+
+typedef struct
+{
+    EventKind kind;
+    uint32_t a;
+    uint32_t b;
+    int64_t bytes;
+} Event;
+
+typedef struct
+{
+    SimObject *objects;
+    size_t objectCount;
+    size_t objectCapacity;
+    Event *events;
+    size_t eventCount;
+    size_t eventCapacity;
+    uint64_t clock;
+    uint64_t lastCollection;
+    size_t collections;
+    double usPerSurvivor;
+} Trace;
+
+// open addressing map from traced object ids to object indexes
+typedef struct
+{
+    uint64_t *keys; // 0 marks an empty entry, ids are never 0
+    uint32_t *values;
+    size_t count;
+    size_t capacity;
+} IdMap;
+
+typedef struct
+{
+    double growth;
+    size_t nursery;
+    double budgetUs;
+} Policy;
+
+typedef struct
+{
+    size_t collections;
+    size_t minorCollections;
+    double totalUs;
+    double maxUs;
+    double *pauses;
+    size_t pauseCount;
+    size_t pauseCapacity;
+    size_t peakHeap;
+    size_t rememberedEntries;
+} SimResult;
+
+static void *growArray(void *array, size_t *capacity, size_t elementSize)
+{
+    *capacity = *capacity < 64 ? 64 : *capacity * 2;
+    void *result = realloc(array, *capacity * elementSize);
+    if (result == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    return result;
+}
+
+static size_t hashId(uint64_t id, size_t capacity)
+{
+    return (size_t)((id * 0x9e3779b97f4a7c15ull) >> 32) & (capacity - 1);
+}
+
+static void mapSet(IdMap *map, uint64_t id, uint32_t value);
+
+static void mapGrow(IdMap *map)
+{
+    IdMap old = *map;
+    map->capacity = old.capacity < 1024 ? 1024 : old.capacity * 2;
+    map->keys = calloc(map->capacity, sizeof(uint64_t));
+    map->values = malloc(map->capacity * sizeof(uint32_t));
+    if (map->keys == NULL || map->values == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    map->count = 0;
+    for (size_t i = 0; i < old.capacity; i++)
+    {
+        if (old.keys[i] != 0)
+        {
+            mapSet(map, old.keys[i], old.values[i]);
+        }
+    }
+    free(old.keys);
+    free(old.values);
+}
+
+static void mapSet(IdMap *map, uint64_t id, uint32_t value)
+{
+    if ((map->count + 1) * 4 > map->capacity * 3)
+    {
+        mapGrow(map);
+    }
+    size_t index = hashId(id, map->capacity);
+    while (map->keys[index] != 0 && map->keys[index] != id)
+    {
+        index = (index + 1) & (map->capacity - 1);
+    }
+    if (map->keys[index] == 0)
+    {
+        map->count++;
+    }
+    map->keys[index] = id;
+    map->values[index] = value;
+}
+
+static bool mapGet(IdMap *map, uint64_t id, uint32_t *value)
+{
+    if (map->count == 0)
+    {
+        return false;
+    }
+    size_t index = hashId(id, map->capacity);
+    while (map->keys[index] != 0)
+    {
+        if (map->keys[index] == id)
+        {
+            *value = map->values[index];
+            return true;
+        }
+        index = (index + 1) & (map->capacity - 1);
+    }
+    return false;
+}
+
+static void mapDelete(IdMap *map, uint64_t id)
+{
+    if (map->count == 0)
+    {
+        return;
+    }
+    size_t index = hashId(id, map->capacity);
+    while (map->keys[index] != id)
+    {
+        if (map->keys[index] == 0)
+        {
+            return;
+        }
+        index = (index + 1) & (map->capacity - 1);
+    }
+    // shift later entries of the probe sequence back instead of leaving a tombstone
+    size_t hole = index;
+    size_t next = (index + 1) & (map->capacity - 1);
+    while (map->keys[next] != 0)
+    {
+        size_t home = hashId(map->keys[next], map->capacity);
+        if (((next - home) & (map->capacity - 1)) >= ((next - hole) & (map->capacity - 1)))
+        {
+            map->keys[hole] = map->keys[next];
+            map->values[hole] = map->values[next];
+            hole = next;
+        }
+        next = (next + 1) & (map->capacity - 1);
+    }
+    map->keys[hole] = 0;
+    map->count--;
+}
+
+static bool readVarint(FILE *file, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int c = getc(file);
+        if (c == EOF)
+        {
+            return false;
+        }
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void addEvent(Trace *trace, EventKind kind, uint32_t a, uint32_t b, int64_t bytes)
+{
+    if (trace->eventCount == trace->eventCapacity)
+    {
+        trace->events = growArray(trace->events, &trace->eventCapacity, sizeof(Event));
+    }
+    trace->events[trace->eventCount++] = (Event){kind, a, b, bytes};
+}
+
+static void killObject(Trace *trace, IdMap *ids, uint64_t id, uint64_t when)
+{
+    uint32_t index;
+    if (mapGet(ids, id, &index))
+    {
+        trace->objects[index].death = when;
+        mapDelete(ids, id);
+    }
+}
+
+static bool loadTrace(const char *path, Trace *trace)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open trace \"%s\".\n", path);
+        return false;
+    }
+    char magic[sizeof(GC_TRACE_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, GC_TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "\"%s\" is not a GC trace.\n", path);
+        fclose(file);
+        return false;
+    }
+
+    IdMap ids = {0};
+    double markUs = 0;
+    double survivors = 0;
+    bool ended = false;
+    bool valid = true;
+    int tag;
+    while (valid && !ended && (tag = getc(file)) != EOF)
+    {
+        uint64_t a, b, c, d;
+        switch (tag)
+        {
+        case GC_TRACE_ALLOC:
+        {
+            int type = getc(file);
+            valid = type != EOF && readVarint(file, &a) && readVarint(file, &b);
+            if (!valid)
+            {
+                break;
+            }
+            if (trace->objectCount == trace->objectCapacity)
+            {
+                trace->objects = growArray(trace->objects, &trace->objectCapacity, sizeof(SimObject));
+            }
+            uint32_t index = (uint32_t)trace->objectCount++;
+            trace->objects[index] = (SimObject){.birth = trace->clock, .death = NEVER, .size = (uint32_t)b};
+            mapSet(&ids, a, index);
+            addEvent(trace, EVENT_ALLOC, index, 0, 0);
+            trace->clock += b;
+            break;
+        }
+        case GC_TRACE_FREE:
+            valid = readVarint(file, &a);
+            killObject(trace, &ids, a, trace->lastCollection);
+            break;
+        case GC_TRACE_DEATH:
+            valid = readVarint(file, &a);
+            killObject(trace, &ids, a, trace->clock);
+            break;
+        case GC_TRACE_BYTES:
+        {
+            valid = readVarint(file, &a);
+            int64_t delta = (int64_t)(a >> 1) ^ -(int64_t)(a & 1);
+            addEvent(trace, EVENT_BYTES, 0, 0, delta);
+            if (delta > 0)
+            {
+                trace->clock += (uint64_t)delta;
+            }
+            break;
+        }
+        case GC_TRACE_STORE:
+        {
+            valid = readVarint(file, &a) && readVarint(file, &b);
+            uint32_t holder, stored;
+            if (valid && mapGet(&ids, a, &holder) && mapGet(&ids, b, &stored))
+            {
+                addEvent(trace, EVENT_STORE, holder, stored, 0);
+            }
+            break;
+        }
+        case GC_TRACE_ROOT:
+        {
+            valid = readVarint(file, &a);
+            uint32_t index;
+            if (valid && mapGet(&ids, a, &index))
+            {
+                trace->objects[index].root = true;
+            }
+            break;
+        }
+        case GC_TRACE_GC:
+            valid = readVarint(file, &a) && readVarint(file, &b) &&
+                    readVarint(file, &c) && readVarint(file, &d);
+            survivors += (double)a;
+            markUs += (double)c;
+            trace->lastCollection = trace->clock;
+            trace->collections++;
+            break;
+        case GC_TRACE_MOVE:
+        {
+            valid = readVarint(file, &a) && readVarint(file, &b);
+            uint32_t index;
+            if (valid && mapGet(&ids, a, &index))
+            {
+                mapDelete(&ids, a);
+                mapSet(&ids, b, index);
+            }
+            break;
+        }
+        case GC_TRACE_END:
+            ended = true;
+            break;
+        default:
+            valid = false;
+            break;
+        }
+    }
+    fclose(file);
+    free(ids.keys);
+    free(ids.values);
+    if (!valid)
+    {
+        fprintf(stderr, "Trace \"%s\" is corrupt.\n", path);
+        return false;
+    }
+    if (!ended)
+    {
+        fprintf(stderr, "warning: trace \"%s\" is truncated.\n", path);
+    }
+    // without traced collections fall back to a rough cost per object
+    trace->usPerSurvivor = survivors > 0 && markUs > 0 ? markUs / survivors : 0.05;
+    return true;
+}
+
+static void recordPause(SimResult *result, double us)
+{
+    if (result->pauseCount == result->pauseCapacity)
+    {
+        result->pauses = growArray(result->pauses, &result->pauseCapacity, sizeof(double));
+    }
+    result->pauses[result->pauseCount++] = us;
+    result->totalUs += us;
+    if (us > result->maxUs)
+    {
+        result->maxUs = us;
+    }
+}
+
+// Objects that have been allocated and not yet reclaimed by the simulated
+// collector. Collections filter them in place.
+typedef struct
+{
+    uint32_t *indexes;
+    size_t count;
+    size_t capacity;
+    size_t bytes;
+} Resident;
+
+static void addResident(Resident *resident, uint32_t index, uint32_t size)
+{
+    if (resident->count == resident->capacity)
+    {
+        resident->indexes = growArray(resident->indexes, &resident->capacity, sizeof(uint32_t));
+    }
+    resident->indexes[resident->count++] = index;
+    resident->bytes += size;
+}
+
+// drops the dead objects and returns how many survived
+static size_t sweepResident(Trace *trace, Resident *resident, uint64_t now, Resident *promoteTo)
+{
+    size_t kept = 0;
+    size_t survivors = 0;
+    resident->bytes = 0;
+    for (size_t i = 0; i < resident->count; i++)
+    {
+        uint32_t index = resident->indexes[i];
+        SimObject *object = &trace->objects[index];
+        object->remembered = false;
+        if (object->death <= now)
+        {
+            continue;
+        }
+        survivors++;
+        if (promoteTo != NULL)
+        {
+            object->old = true;
+            addResident(promoteTo, index, object->size);
+        }
+        else
+        {
+            resident->indexes[kept++] = index;
+            resident->bytes += object->size;
+        }
+    }
+    resident->count = kept;
+    return survivors;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void simulate(Trace *trace, Policy *policy, size_t minHeap, SimResult *result)
+{
+    Resident old = {0};
+    Resident young = {0};
+    int64_t external = 0;
+    uint64_t clock = 0;
+    size_t nextGC = minHeap;
+    size_t remembered = 0;
+
+    // an incremental cycle marks the objects alive at its start in slices;
+    // whatever is allocated until it finishes survives it
+    bool marking = false;
+    double markWork = 0;
+    uint64_t nextSlice = 0;
+    uint64_t cycleStart = 0;
+
+    for (size_t i = 0; i < trace->objectCount; i++)
+    {
+        trace->objects[i].old = false;
+        trace->objects[i].remembered = false;
+    }
+
+    for (size_t i = 0; i < trace->eventCount; i++)
+    {
+        Event *event = &trace->events[i];
+        switch (event->kind)
+        {
+        case EVENT_ALLOC:
+        {
+            SimObject *object = &trace->objects[event->a];
+            clock += object->size;
+            if (policy->nursery > 0)
+            {
+                addResident(&young, event->a, object->size);
+            }
+            else
+            {
+                object->old = true;
+                addResident(&old, event->a, object->size);
+            }
+            break;
+        }
+        case EVENT_BYTES:
+            external += event->bytes;
+            if (event->bytes > 0)
+            {
+                clock += (uint64_t)event->bytes;
+            }
+            break;
+        case EVENT_STORE:
+        {
+            SimObject *holder = &trace->objects[event->a];
+            SimObject *stored = &trace->objects[event->b];
+            if (policy->nursery > 0 && holder->old && !stored->old && !holder->remembered)
+            {
+                holder->remembered = true;
+                remembered++;
+                result->rememberedEntries++;
+            }
+            break;
+        }
+        }
+
+        size_t heap = old.bytes + young.bytes + (external > 0 ? (size_t)external : 0);
+        if (heap > result->peakHeap)
+        {
+            result->peakHeap = heap;
+        }
+
+        if (policy->nursery > 0 && young.bytes >= policy->nursery)
+        {
+            // minor collection: trace the remembered holders and the young survivors
+            size_t survivors = sweepResident(trace, &young, clock, &old);
+            recordPause(result, trace->usPerSurvivor * (double)(survivors + remembered));
+            result->minorCollections++;
+            for (size_t j = 0; j < old.count; j++)
+            {
+                trace->objects[old.indexes[j]].remembered = false;
+            }
+            remembered = 0;
+        }
+
+        size_t oldHeap = old.bytes + (external > 0 ? (size_t)external : 0);
+        if (marking && clock >= nextSlice)
+        {
+            double slice = markWork < policy->budgetUs ? markWork : policy->budgetUs;
+            markWork -= slice;
+            nextSlice = clock + SLICE_BYTES;
+            if (markWork <= 0)
+            {
+                // objects allocated while marking were allocated black
+                sweepResident(trace, &old, cycleStart, NULL);
+                slice += trace->usPerSurvivor * (double)remembered; // final remark
+                marking = false;
+                result->collections++;
+                oldHeap = old.bytes + (external > 0 ? (size_t)external : 0);
+                nextGC = (size_t)((double)oldHeap * policy->growth);
+                nextGC = nextGC < minHeap ? minHeap : nextGC;
+            }
+            recordPause(result, slice);
+        }
+        else if (!marking && oldHeap > nextGC)
+        {
+            size_t live = 0;
+            for (size_t j = 0; j < old.count; j++)
+            {
+                live += trace->objects[old.indexes[j]].death > clock;
+            }
+            double work = trace->usPerSurvivor * (double)live;
+            if (policy->budgetUs > 0 && work > policy->budgetUs)
+            {
+                marking = true;
+                markWork = work;
+                cycleStart = clock;
+                nextSlice = clock;
+            }
+            else
+            {
+                sweepResident(trace, &old, clock, NULL);
+                recordPause(result, work);
+                result->collections++;
+                oldHeap = old.bytes + (external > 0 ? (size_t)external : 0);
+                nextGC = (size_t)((double)oldHeap * policy->growth);
+                nextGC = nextGC < minHeap ? minHeap : nextGC;
+            }
+        }
+    }
+    free(old.indexes);
+    free(young.indexes);
+}
+
+static void printResult(Policy *policy, SimResult *result)
+{
+    double p95 = 0;
+    if (result->pauseCount > 0)
+    {
+        qsort(result->pauses, result->pauseCount, sizeof(double), compareDoubles);
+        p95 = result->pauses[(result->pauseCount - 1) * 95 / 100];
+    }
+    printf("%6.2f %9zu %8.0f | %6zu %6zu %10.3f %9.3f %9.3f %10zu %9zu\n",
+           policy->growth, policy->nursery, policy->budgetUs,
+           result->collections, result->minorCollections,
+           result->totalUs / 1000, result->maxUs / 1000, p95 / 1000,
+           result->peakHeap, result->rememberedEntries);
+}
+
+static bool parseSize(const char *text, size_t *size)
+{
+    char *end;
+    double value = strtod(text, &end);
+    if (end == text || value < 0)
+    {
+        return false;
+    }
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        value *= 1024;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        value *= 1024 * 1024;
+        end++;
+        break;
+    case 'g':
+    case 'G':
+        value *= 1024 * 1024 * 1024;
+        end++;
+        break;
+    }
+    *size = (size_t)value;
+    return *end == '\0';
+}
+
+// parses a comma separated list of sizes or numbers into values
+static int parseList(const char *text, double *values, bool sizes)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", text);
+    int count = 0;
+    for (char *item = strtok(buffer, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        if (count == MAX_POLICIES)
+        {
+            return -1;
+        }
+        size_t size;
+        char *end;
+        if (sizes)
+        {
+            if (!parseSize(item, &size))
+            {
+                return -1;
+            }
+            values[count++] = (double)size;
+        }
+        else
+        {
+            values[count++] = strtod(item, &end);
+            if (end == item || *end != '\0' || !(values[count - 1] >= 0))
+            {
+                return -1;
+            }
+        }
+    }
+    return count;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: gcsim <trace> [--growth=1.5,2,3] [--nursery=0,1m] "
+                    "[--budget=0,500] [--min-heap=1m]\n");
+    exit(64);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        usage();
+    }
+    double growths[MAX_POLICIES] = {1.5, 2, 3};
+    double nurseries[MAX_POLICIES] = {0, 256 * 1024, 1024 * 1024};
+    double budgets[MAX_POLICIES] = {0, 500};
+    int growthCount = 3;
+    int nurseryCount = 3;
+    int budgetCount = 2;
+    size_t minHeap = 1024 * 1024;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--growth=", 9) == 0)
+        {
+            growthCount = parseList(argv[i] + 9, growths, false);
+            for (int g = 0; g < growthCount; g++)
+            {
+                if (!(growths[g] > 1)) // like --gc-growth, the trigger must stay above the live heap
+                {
+                    usage();
+                }
+            }
+        }
+        else if (strncmp(argv[i], "--nursery=", 10) == 0)
+        {
+            nurseryCount = parseList(argv[i] + 10, nurseries, true);
+        }
+        else if (strncmp(argv[i], "--budget=", 9) == 0)
+        {
+            budgetCount = parseList(argv[i] + 9, budgets, false);
+        }
+        else if (strncmp(argv[i], "--min-heap=", 11) == 0)
+        {
+            if (!parseSize(argv[i] + 11, &minHeap))
+            {
+                usage();
+            }
+        }
+        else
+        {
+            usage();
+        }
+        if (growthCount <= 0 || nurseryCount <= 0 || budgetCount <= 0)
+        {
+            usage();
+        }
+    }
+
+    Trace trace = {0};
+    if (!loadTrace(argv[1], &trace))
+    {
+        return 74;
+    }
+    printf("trace: %zu objects, %zu events, %zu bytes allocated, %zu collections, %.3f us/survivor\n",
+           trace.objectCount, trace.eventCount, (size_t)trace.clock, trace.collections, trace.usPerSurvivor);
+    printf("growth   nursery budget | %6s %6s %10s %9s %9s %10s %9s\n",
+           "gcs", "minor", "total ms", "max ms", "p95 ms", "peak heap", "remset");
+    for (int g = 0; g < growthCount; g++)
+    {
+        for (int n = 0; n < nurseryCount; n++)
+        {
+            for (int b = 0; b < budgetCount; b++)
+            {
+                Policy policy = {growths[g], (size_t)nurseries[n], budgets[b]};
+                SimResult result = {0};
+                simulate(&trace, &policy, minHeap, &result);
+                printResult(&policy, &result);
+                free(result.pauses);
+            }
+        }
+    }
+    free(trace.objects);
+    free(trace.events);
+    return 0;
+}
\ No newline at end of file